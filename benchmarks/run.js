@@ -74,6 +74,328 @@ bm('fillStyle= rgba()', function(){
   ctx.fillStyle = 'rgba(0,255,80,1)';
 });
 
+bm('save() / restore()', function(){
+  ctx.save();
+  ctx.fillStyle = '#FFCCAA';
+  ctx.save();
+  ctx.restore();
+  ctx.restore();
+});
+
+bm('font= / save() / restore()', function(){
+  ctx.save();
+  ctx.font = 'bold 14px Arial';
+  ctx.restore();
+  ctx.font = '10px sans-serif';
+});
+
+bm('fillText() repeated label', function(){
+  ctx.fillText('Revenue (USD)', 20, 20);
+});
+
+bm('measureText() repeated label', function(){
+  ctx.measureText('Revenue (USD)');
+});
+
+var batchLabels = [], batchXs = new Float64Array(1000), batchYs = new Float64Array(1000);
+for (var i = 0; i < 1000; ++i) {
+  batchLabels.push('label ' + (i % 50));
+  batchXs[i] = i % 200;
+  batchYs[i] = (i * 7) % 200;
+}
+
+bm('fillText() x1000', function(){
+  for (var i = 0; i < 1000; ++i) ctx.fillText(batchLabels[i], batchXs[i], batchYs[i]);
+});
+
+bm('fillTextBatch() x1000', function(){
+  ctx.fillTextBatch(batchLabels, batchXs, batchYs);
+});
+
+var pathCtx = new Canvas(200, 200).getContext('2d')
+  , sprite = new Canvas(16, 16);
+sprite.getContext('2d').fillRect(0, 0, 16, 16);
+pathCtx.beginPath();
+for (var i = 0; i < 10000; ++i) pathCtx.lineTo(i % 200, (i * 13) % 200);
+
+bm('drawImage() x1000 with a 10k-segment open path', function(){
+  for (var i = 0; i < 1000; ++i) pathCtx.drawImage(sprite, i % 184, (i * 7) % 184);
+});
+
+var sheet = new Canvas(256, 256);
+sheet.getContext('2d').fillRect(0, 0, 256, 256);
+
+bm('drawImage() x1000 32x32 sprite blits', function(){
+  for (var i = 0; i < 1000; ++i) {
+    ctx.drawImage(sheet, (i % 8) * 32, 0, 32, 32, i % 168, (i * 7) % 168, 32, 32);
+  }
+});
+
+bm('drawImage() x1000 32x32 sprites at globalAlpha 0.99', function(){
+  ctx.globalAlpha = 0.99;
+  for (var i = 0; i < 1000; ++i) {
+    ctx.drawImage(sheet, (i % 8) * 32, 0, 32, 32, i % 168, (i * 7) % 168, 32, 32);
+  }
+  ctx.globalAlpha = 1;
+});
+
+var photo = new Canvas(6000, 4000)
+  , photoCtx = photo.getContext('2d')
+  , thumbCtx = new Canvas(300, 200).getContext('2d')
+  , photoImage = new Canvas.Image();
+for (var i = 0; i < 6000; i += 3) {
+  photoCtx.fillStyle = i % 2 ? '#123' : '#fed';
+  photoCtx.fillRect(i, 0, 1, 4000);
+}
+photoImage.src = photo.toBuffer(undefined, 0, photo.PNG_FILTER_NONE);
+photo = photoCtx = null;
+
+bm('drawImage() 6000px->300px', function(){
+  thumbCtx.imageSmoothingQuality = 'low';
+  thumbCtx.drawImage(photoImage, 0, 0, 300, 200);
+});
+
+bm('drawImage() 6000px->300px imageSmoothingQuality high', function(){
+  thumbCtx.imageSmoothingQuality = 'high';
+  thumbCtx.drawImage(photoImage, 0, 0, 300, 200);
+});
+
+var outlineXY = new Float64Array(2000);
+for (var i = 0; i < 1000; ++i) {
+  outlineXY[i * 2] = 100 + 80 * Math.cos(i / 1000 * Math.PI * 2);
+  outlineXY[i * 2 + 1] = 100 + 80 * Math.sin(i / 1000 * Math.PI * 2);
+}
+var outline = new Canvas.Path2D(outlineXY, true);
+
+bm('fill() 1000-vertex outline via lineTo()', function(){
+  ctx.beginPath();
+  ctx.moveTo(outlineXY[0], outlineXY[1]);
+  for (var i = 1; i < 1000; ++i) ctx.lineTo(outlineXY[i * 2], outlineXY[i * 2 + 1]);
+  ctx.closePath();
+  ctx.fill();
+});
+
+bm('fill(path) 1000-vertex Path2D', function(){
+  ctx.fill(outline);
+});
+
+var seriesXY = new Float64Array(100000 * 2);
+for (var i = 0; i < 100000; ++i) {
+  seriesXY[i * 2] = i / 500;
+  seriesXY[i * 2 + 1] = 100 + 50 * Math.sin(i / 300);
+}
+
+bm('lineTo() 100k-point series', function(){
+  ctx.beginPath();
+  ctx.moveTo(seriesXY[0], seriesXY[1]);
+  for (var i = 1; i < 100000; ++i) ctx.lineTo(seriesXY[i * 2], seriesXY[i * 2 + 1]);
+  ctx.beginPath();
+});
+
+bm('polyline() 100k-point series', function(){
+  ctx.beginPath();
+  ctx.polyline(seriesXY);
+  ctx.beginPath();
+});
+
+bm('polyline() 100k-point series simplified', function(){
+  ctx.beginPath();
+  ctx.polyline(seriesXY, false, true);
+  ctx.beginPath();
+});
+
+var bars = new Canvas.CommandBuffer();
+
+function drawBars(c) {
+  for (var i = 0; i < 1000; ++i) {
+    c.beginPath();
+    c.moveTo(i / 5, 200);
+    c.lineTo(i / 5, 200 - (i % 97));
+    c.lineTo(i / 5 + 1, 200 - (i % 97));
+    c.closePath();
+    c.fill();
+  }
+}
+
+bm('1000 bars per-call', function(){
+  drawBars(ctx);
+});
+
+bm('1000 bars execute()', function(){
+  drawBars(bars.reset());
+  ctx.execute(bars);
+});
+
+var recording = new Canvas(200, 200, 'recording')
+  , rctx = recording.getContext('2d');
+
+function drawTemplate(c) {
+  c.fillStyle = '#eee';
+  c.fillRect(0, 0, 200, 30);
+  c.strokeStyle = '#ccc';
+  for (var i = 0; i <= 200; i += 10) {
+    c.beginPath();
+    c.moveTo(i, 30);
+    c.lineTo(i, 200);
+    c.moveTo(0, i);
+    c.lineTo(200, i);
+    c.stroke();
+  }
+}
+
+drawTemplate(rctx);
+
+bm('redraw template', function(){
+  drawTemplate(ctx);
+});
+
+bm('drawImage() recorded template', function(){
+  ctx.drawImage(recording, 0, 0);
+});
+
+bm('fillRect() 600x600 with shadowBlur 40', function(){
+  var c = largeCanvas.getContext('2d');
+  c.save();
+  c.shadowColor = 'rgba(0,0,0,0.5)';
+  c.shadowBlur = 40;
+  c.fillRect(100, 100, 600, 600);
+  c.restore();
+});
+
+bm('fillRect() repeated card with shadowBlur 10', function(){
+  ctx.save();
+  ctx.shadowColor = 'rgba(0,0,0,0.3)';
+  ctx.shadowBlur = 10;
+  ctx.shadowOffsetY = 2;
+  ctx.fillStyle = '#fff';
+  ctx.fillRect(40, 40, 120, 80);
+  ctx.restore();
+});
+
+var shadowShapes = 0;
+
+bm('arc() fill of unique shapes with shadowBlur 8', function(){
+  ctx.save();
+  ctx.shadowColor = 'rgba(0,0,0,0.5)';
+  ctx.shadowBlur = 8;
+  ctx.beginPath();
+  ctx.arc(100, 100, 40 + (shadowShapes++ % 1000) / 100, 0, Math.PI * 2);
+  ctx.fill();
+  ctx.restore();
+});
+
+var frameBuffer = new ArrayBuffer(1000 * 1000 * 4)
+  , frameCanvas = new Canvas(1000, 1000, { buffer: frameBuffer });
+
+bm('frame 1000x1000 read via getImageData()', function(){
+  var c = largeCanvas.getContext('2d');
+  c.fillRect(0, 0, 10, 10);
+  c.getImageData(0, 0, 1000, 1000).data[0];
+});
+
+bm('frame 1000x1000 read via external buffer', function(){
+  frameCanvas.getContext('2d').fillRect(0, 0, 10, 10);
+  frameCanvas.flush();
+  new Uint8Array(frameBuffer)[0];
+});
+
+function drawPoster(c) {
+  for (var i = 0; i < 2000; ++i) {
+    c.fillStyle = 'rgba(' + (i % 255) + ',80,160,0.5)';
+    c.beginPath();
+    c.arc((i * 397) % 4000, (i * 641) % 4000, 60, 0, Math.PI * 2);
+    c.fill();
+  }
+}
+
+bm('4000x4000 poster toBuffer()', function(){
+  var c = new Canvas(4000, 4000);
+  drawPoster(c.getContext('2d'));
+  c.toBuffer(undefined, 0, c.PNG_FILTER_NONE);
+});
+
+bm('4000x4000 poster toBuffer() tiled', function(){
+  var c = new Canvas(4000, 4000, { tiled: true });
+  drawPoster(c.getContext('2d'));
+  c.toBuffer(undefined, 0, c.PNG_FILTER_NONE);
+});
+
+bm('1000x1000 variant via drawImage()', function(){
+  var c = new Canvas(1000, 1000)
+    , x = c.getContext('2d');
+  x.drawImage(largeCanvas, 0, 0);
+  x.fillText('variant', 100, 100);
+  c.dispose();
+});
+
+bm('1000x1000 variant via clone()', function(){
+  var c = largeCanvas.clone();
+  c.getContext('2d').fillText('variant', 100, 100);
+  c.dispose();
+});
+
+var heatmap = new Canvas(1000, 1000)
+  , heatmapA8 = new Canvas(1000, 1000, { pixelFormat: 'A8' });
+
+bm('radial heatmap points ARGB32', function(){
+  drawHeat(heatmap.getContext('2d'));
+});
+
+bm('radial heatmap points A8', function(){
+  drawHeat(heatmapA8.getContext('2d'));
+});
+
+function drawHeat(c) {
+  for (var i = 0; i < 50; ++i) {
+    var x = (i * 197) % 1000, y = (i * 331) % 1000;
+    var g = c.createRadialGradient(x, y, 0, x, y, 40);
+    g.addColorStop(0, 'rgba(0,0,0,0.2)');
+    g.addColorStop(1, 'rgba(0,0,0,0)');
+    c.fillStyle = g;
+    c.fillRect(x - 40, y - 40, 80, 80);
+  }
+}
+
+bm('new Canvas(1000, 1000) fill and release', function(){
+  var c = new Canvas(1000, 1000);
+  c.getContext('2d').fillRect(0, 0, 10, 10);
+  c.release();
+});
+
+bm('new Canvas(1000, 1000) fill and release, pooled', function(){
+  Canvas.setSurfacePoolLimit(16 * 1024 * 1024);
+  var c = new Canvas(1000, 1000);
+  c.getContext('2d').fillRect(0, 0, 10, 10);
+  c.release();
+  Canvas.setSurfacePoolLimit(0);
+});
+
+bm('Canvas.diff() 1000x1000', function(){
+  Canvas.diff(largeCanvas, largeCanvas);
+});
+
+bm('Canvas.diff() 1000x1000 async', function(done){
+  Canvas.diff(largeCanvas, largeCanvas, done);
+});
+
+bm('fillRect() and getDirtyRegions(256) 1000x1000', function(){
+  var ctx = largeCanvas.getContext('2d');
+  for (var i = 0; i < 20; ++i) ctx.fillRect(i * 47, i * 31, 40, 40);
+  largeCanvas.getDirtyRegions(256);
+  largeCanvas.clearDirty();
+});
+
+bm('canvas.width = canvas.width 1000x1000', function(){
+  largeCanvas.width = largeCanvas.width;
+});
+
+bm('new Canvas(1000, 1000) resized before drawing', function(){
+  var c = new Canvas(1000, 1000);
+  c.width = 800;
+  c.height = 600;
+  c.getContext('2d').fillRect(0, 0, 10, 10);
+});
+
 // Apparently there's a bug in cairo by which the fillRect and strokeRect are
 // slow only after a ton of arcs have been drawn.
 bm('fillRect()', function(){
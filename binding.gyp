@@ -41,14 +41,22 @@
       'target_name': 'canvas',
       'include_dirs': ["<!(node -e \"require('nan')\")"],
       'sources': [
+        'src/blur.cc',
         'src/Canvas.cc',
         'src/CanvasGradient.cc',
         'src/CanvasPattern.cc',
         'src/CanvasRenderingContext2d.cc',
         'src/color.cc',
+        'src/diff.cc',
         'src/Image.cc',
         'src/ImageData.cc',
-        'src/init.cc'
+        'src/init.cc',
+        'src/mipmap.cc',
+        'src/Path2D.cc',
+        'src/snapshot.cc',
+        'src/ShadowCache.cc',
+        'src/SurfacePool.cc',
+        'src/tiles.cc'
       ],
       'conditions': [
         ['OS=="win"', {
@@ -117,6 +125,9 @@
           'defines': [
             'HAVE_PANGO'
           ],
+          'sources': [
+            'src/TextLayoutCache.cc'
+          ],
           'conditions': [
             ['OS=="win"', {
               'libraries': [
@@ -75,6 +75,8 @@ exports.PDFStream = PDFStream;
 exports.JPEGStream = JPEGStream;
 exports.Image = Image;
 exports.ImageData = canvas.ImageData;
+exports.Path2D = canvas.Path2D;
+exports.CommandBuffer = Context2d.CommandBuffer;
 
 if (FontFace) {
   var Font = function Font(name, path, idx) {
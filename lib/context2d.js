@@ -369,3 +369,202 @@ Context2d.prototype.createImageData = function(width, height){
   }
   return new ImageData(new Uint8ClampedArray(width * height * 4), width, height);
 };
+
+/**
+ * Run the commands recorded in a `CommandBuffer`, or a raw
+ * `ArrayBuffer` / view holding the same encoding, in one call.
+ *
+ * @param {CommandBuffer|ArrayBuffer|ArrayBufferView} commands
+ * @api public
+ */
+
+Context2d.prototype.execute = function(commands){
+  if (commands instanceof CommandBuffer) {
+    return this._execute(commands.buffer, commands.length);
+  } else if (commands instanceof ArrayBuffer) {
+    commands = new Float64Array(commands);
+  } else if (ArrayBuffer.isView(commands) && !(commands instanceof Float64Array)) {
+    commands = new Float64Array(commands.buffer, commands.byteOffset, commands.byteLength / 8);
+  }
+  this._execute(commands);
+};
+
+/**
+ * Initialize a new `CommandBuffer`, an encoder for `Context2d#execute()`.
+ * Commands are stored as an opcode followed by their operands, all as
+ * doubles, and mirror the context methods of the same name.
+ *
+ * @param {Number} size, optional initial capacity in doubles
+ * @api public
+ */
+
+var CommandBuffer = Context2d.CommandBuffer = function CommandBuffer(size){
+  this.buffer = new Float64Array(size || 1024);
+  this.length = 0;
+};
+
+/**
+ * Discard the recorded commands, keeping the storage.
+ *
+ * @return {CommandBuffer}
+ * @api public
+ */
+
+CommandBuffer.prototype.reset = function(){
+  this.length = 0;
+  return this;
+};
+
+/**
+ * Ensure room for `n` more doubles.
+ *
+ * @api private
+ */
+
+CommandBuffer.prototype._reserve = function(n){
+  if (this.length + n <= this.buffer.length) return;
+  var size = this.buffer.length * 2;
+  while (size < this.length + n) size *= 2;
+  var buffer = new Float64Array(size);
+  buffer.set(this.buffer.subarray(0, this.length));
+  this.buffer = buffer;
+};
+
+/**
+ * Return a method appending opcode `code` with `n` numeric operands.
+ *
+ * @api private
+ */
+
+function command(code, n) {
+  switch (n) {
+    case 0: return function(){
+      this._reserve(1);
+      this.buffer[this.length++] = code;
+      return this;
+    };
+    case 1: return function(a){
+      this._reserve(2);
+      var b = this.buffer, i = this.length;
+      b[i] = code; b[i + 1] = a;
+      this.length = i + 2;
+      return this;
+    };
+    case 2: return function(a, c){
+      this._reserve(3);
+      var b = this.buffer, i = this.length;
+      b[i] = code; b[i + 1] = a; b[i + 2] = c;
+      this.length = i + 3;
+      return this;
+    };
+    case 4: return function(a, c, d, e){
+      this._reserve(5);
+      var b = this.buffer, i = this.length;
+      b[i] = code; b[i + 1] = a; b[i + 2] = c; b[i + 3] = d; b[i + 4] = e;
+      this.length = i + 5;
+      return this;
+    };
+    case 5: return function(a, c, d, e, f){
+      this._reserve(6);
+      var b = this.buffer, i = this.length;
+      b[i] = code; b[i + 1] = a; b[i + 2] = c; b[i + 3] = d; b[i + 4] = e; b[i + 5] = f;
+      this.length = i + 6;
+      return this;
+    };
+    case 6: return function(a, c, d, e, f, g){
+      this._reserve(7);
+      var b = this.buffer, i = this.length;
+      b[i] = code; b[i + 1] = a; b[i + 2] = c; b[i + 3] = d; b[i + 4] = e; b[i + 5] = f; b[i + 6] = g;
+      this.length = i + 7;
+      return this;
+    };
+  }
+}
+
+/**
+ * Opcodes and operand counts, matching canvas_command_t.
+ */
+
+var commands = {
+    save: [1, 0]
+  , restore: [2, 0]
+  , beginPath: [3, 0]
+  , closePath: [4, 0]
+  , moveTo: [5, 2]
+  , lineTo: [6, 2]
+  , bezierCurveTo: [7, 6]
+  , quadraticCurveTo: [8, 4]
+  , arcTo: [10, 5]
+  , rect: [11, 4]
+  , stroke: [14, 0]
+  , fillRect: [16, 4]
+  , strokeRect: [17, 4]
+  , clearRect: [18, 4]
+  , translate: [19, 2]
+  , scale: [20, 2]
+  , rotate: [21, 1]
+  , transform: [22, 6]
+  , setTransform: [23, 6]
+  , setLineWidth: [26, 1]
+  , setGlobalAlpha: [27, 1]
+};
+
+Object.keys(commands).forEach(function(name){
+  CommandBuffer.prototype[name] = command(commands[name][0], commands[name][1]);
+});
+
+var arc = command(9, 6)
+  , fill = command(13, 1)
+  , clip = command(15, 1)
+  , fillColor = command(24, 4)
+  , strokeColor = command(25, 4);
+
+CommandBuffer.prototype.arc = function(x, y, radius, startAngle, endAngle, anticlockwise){
+  return arc.call(this, x, y, radius, startAngle, endAngle, anticlockwise ? 1 : 0);
+};
+
+CommandBuffer.prototype.fill = function(rule){
+  return fill.call(this, 'evenodd' == rule ? 1 : 0);
+};
+
+CommandBuffer.prototype.clip = function(rule){
+  return clip.call(this, 'evenodd' == rule ? 1 : 0);
+};
+
+/**
+ * Set the fill or stroke color, `r`, `g`, `b` in [0, 255]
+ * and alpha in [0, 1] defaulting to 1.
+ *
+ * @api public
+ */
+
+CommandBuffer.prototype.setFillColor = function(r, g, b, a){
+  return fillColor.call(this, r, g, b, null == a ? 1 : a);
+};
+
+CommandBuffer.prototype.setStrokeColor = function(r, g, b, a){
+  return strokeColor.call(this, r, g, b, null == a ? 1 : a);
+};
+
+/**
+ * Add a polyline through the `x, y` pairs of `xy`.
+ *
+ * @param {Float64Array|Array} xy
+ * @param {Boolean} closed
+ * @return {CommandBuffer}
+ * @api public
+ */
+
+CommandBuffer.prototype.polyline = function(xy, closed){
+  var n = xy.length >> 1;
+  this._reserve(3 + n * 2);
+  var b = this.buffer, i = this.length;
+  b[i] = 12; b[i + 1] = n; b[i + 2] = closed ? 1 : 0;
+  if (xy instanceof Float64Array) {
+    b.set(xy.subarray(0, n * 2), i + 3);
+  } else {
+    for (var j = 0; j < n * 2; ++j) b[i + 3 + j] = xy[j];
+  }
+  this.length = i + 3 + n * 2;
+  return this;
+};
@@ -8,19 +8,26 @@
 #include "PNG.h"
 #include "CanvasRenderingContext2d.h"
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <cmath>
 #include <node_buffer.h>
 #include <node_version.h>
 #include <cairo-pdf.h>
 #include <cairo-svg.h>
 #include "closure.h"
+#include "diff.h"
+#include "SurfacePool.h"
+#include "snapshot.h"
+#include "tiles.h"
 
 #ifdef HAVE_JPEG
 #include "JPEGStream.h"
 #endif
 
-Nan::Persistent<FunctionTemplate> Canvas::constructor;
+IsolatePersistent<FunctionTemplate> Canvas::constructor;
 
 /*
  * Initialize Canvas.
@@ -41,10 +48,18 @@ Canvas::Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target) {
   Nan::SetPrototypeMethod(ctor, "toBuffer", ToBuffer);
   Nan::SetPrototypeMethod(ctor, "streamPNGSync", StreamPNGSync);
   Nan::SetPrototypeMethod(ctor, "streamPDFSync", StreamPDFSync);
+  Nan::SetPrototypeMethod(ctor, "release", Release);
+  Nan::SetPrototypeMethod(ctor, "dispose", Dispose);
+  Nan::SetPrototypeMethod(ctor, "flush", Flush);
+  Nan::SetPrototypeMethod(ctor, "clone", Clone);
+  Nan::SetPrototypeMethod(ctor, "transfer", Transfer);
+  Nan::SetPrototypeMethod(ctor, "getDirtyRegions", GetDirtyRegions);
+  Nan::SetPrototypeMethod(ctor, "clearDirty", ClearDirty);
 #ifdef HAVE_JPEG
   Nan::SetPrototypeMethod(ctor, "streamJPEGSync", StreamJPEGSync);
 #endif
   Nan::SetAccessor(proto, Nan::New("type").ToLocalChecked(), GetType);
+  Nan::SetAccessor(proto, Nan::New("pixelFormat").ToLocalChecked(), GetPixelFormat);
   Nan::SetAccessor(proto, Nan::New("width").ToLocalChecked(), GetWidth, SetWidth);
   Nan::SetAccessor(proto, Nan::New("height").ToLocalChecked(), GetHeight, SetHeight);
 
@@ -56,6 +71,11 @@ Canvas::Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target) {
   Nan::SetTemplate(proto, "PNG_FILTER_PAETH", Nan::New<Uint32>(PNG_FILTER_PAETH));
   Nan::SetTemplate(proto, "PNG_ALL_FILTERS", Nan::New<Uint32>(PNG_ALL_FILTERS));
 
+  // Class methods
+  Nan::SetMethod(ctor, "surfacePoolStats", SurfacePoolStats);
+  Nan::SetMethod(ctor, "setSurfacePoolLimit", SetSurfacePoolLimit);
+  Nan::SetMethod(ctor, "diff", Diff);
+
   Nan::Set(target, Nan::New("Canvas").ToLocalChecked(), ctor->GetFunction());
 }
 
@@ -70,14 +90,86 @@ NAN_METHOD(Canvas::New) {
 
   int width = 0, height = 0;
   canvas_type_t type = CANVAS_TYPE_IMAGE;
+  cairo_format_t format = CAIRO_FORMAT_ARGB32;
+  Local<Value> typeName = info[2]
+    , formatName = Nan::Undefined()
+    , bufferValue = Nan::Undefined()
+    , strideValue = Nan::Undefined();
+  bool tiled = false;
   if (info[0]->IsNumber()) width = info[0]->Uint32Value();
   if (info[1]->IsNumber()) height = info[1]->Uint32Value();
-  if (info[2]->IsString()) type = !strcmp("pdf", *String::Utf8Value(info[2]))
+
+  // type string, or { type, pixelFormat, buffer, stride, tiled }
+  if (info[2]->IsObject()) {
+    Local<Object> options = info[2]->ToObject();
+    typeName = options->Get(Nan::New("type").ToLocalChecked());
+    formatName = options->Get(Nan::New("pixelFormat").ToLocalChecked());
+    bufferValue = options->Get(Nan::New("buffer").ToLocalChecked());
+    strideValue = options->Get(Nan::New("stride").ToLocalChecked());
+    tiled = options->Get(Nan::New("tiled").ToLocalChecked())->BooleanValue();
+  }
+
+  if (typeName->IsString()) type = !strcmp("pdf", *String::Utf8Value(typeName))
     ? CANVAS_TYPE_PDF
-    : !strcmp("svg", *String::Utf8Value(info[2]))
+    : !strcmp("svg", *String::Utf8Value(typeName))
       ? CANVAS_TYPE_SVG
-      : CANVAS_TYPE_IMAGE;
-  Canvas *canvas = new Canvas(width, height, type);
+      : !strcmp("recording", *String::Utf8Value(typeName))
+        ? CANVAS_TYPE_RECORDING
+        : CANVAS_TYPE_IMAGE;
+
+  // Tiled image canvases record, and rasterize in parallel when read
+  if (tiled) {
+    if (CANVAS_TYPE_IMAGE != type || !formatName->IsUndefined() || !bufferValue->IsUndefined())
+      return Nan::ThrowTypeError("tiled is only supported by ARGB32 image canvases");
+    type = CANVAS_TYPE_RECORDING;
+  }
+#if CAIRO_VERSION_MINOR < 10
+  if (CANVAS_TYPE_RECORDING == type)
+    return Nan::ThrowError("recording canvases require cairo 1.10 or newer");
+#endif
+
+  if (!formatName->IsUndefined()) {
+    String::Utf8Value name(formatName);
+    if (!strcmp("ARGB32", *name)) format = CAIRO_FORMAT_ARGB32;
+    else if (!strcmp("RGB24", *name)) format = CAIRO_FORMAT_RGB24;
+    else if (!strcmp("A8", *name)) format = CAIRO_FORMAT_A8;
+    else if (!strcmp("RGB16_565", *name)) format = CAIRO_FORMAT_RGB16_565;
+    else if (!strcmp("A1", *name)) format = CAIRO_FORMAT_A1;
+    else return Nan::ThrowTypeError("invalid pixelFormat");
+    if (CAIRO_FORMAT_ARGB32 != format && CANVAS_TYPE_IMAGE != type)
+      return Nan::ThrowTypeError("pixelFormat is only supported by image canvases");
+  }
+
+  // Caller-provided pixel memory
+  Local<Object> buffer;
+  int stride = 0;
+  if (!bufferValue->IsUndefined()) {
+    if (CANVAS_TYPE_IMAGE != type)
+      return Nan::ThrowTypeError("buffer is only supported by image canvases");
+    if (bufferValue->IsArrayBuffer()) {
+      Local<ArrayBuffer> ab = bufferValue.As<ArrayBuffer>();
+      bufferValue = Uint8Array::New(ab, 0, ab->ByteLength());
+#if NODE_MAJOR_VERSION >= 6
+    } else if (bufferValue->IsSharedArrayBuffer()) {
+      Local<SharedArrayBuffer> sab = bufferValue.As<SharedArrayBuffer>();
+      bufferValue = Uint8Array::New(sab, 0, sab->ByteLength());
+#endif
+    }
+    if (!bufferValue->IsArrayBufferView())
+      return Nan::ThrowTypeError("buffer must be an ArrayBuffer, SharedArrayBuffer or view");
+
+    int minStride = cairo_format_stride_for_width(format, width);
+    stride = strideValue->IsUndefined() ? minStride : strideValue->Int32Value();
+    if (stride < minStride || stride % 4)
+      return Nan::ThrowRangeError("invalid stride");
+    Nan::TypedArrayContents<uint8_t> contents(bufferValue);
+    if ((size_t) stride * height > contents.length())
+      return Nan::ThrowRangeError("buffer is too small for the canvas");
+    buffer = bufferValue->ToObject();
+  }
+
+  Canvas *canvas = new Canvas(width, height, type, format, buffer, stride);
+  canvas->tiled = tiled;
   canvas->Wrap(info.This());
   info.GetReturnValue().Set(info.This());
 }
@@ -88,7 +180,31 @@ NAN_METHOD(Canvas::New) {
 
 NAN_GETTER(Canvas::GetType) {
   Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
-  info.GetReturnValue().Set(Nan::New<String>(canvas->isPDF() ? "pdf" : canvas->isSVG() ? "svg" : "image").ToLocalChecked());
+  info.GetReturnValue().Set(Nan::New<String>(canvas->isPDF() ? "pdf" : canvas->isSVG() ? "svg" : canvas->isRecording() && !canvas->tiled ? "recording" : "image").ToLocalChecked());
+}
+
+/*
+ * Return the name of the given pixel format.
+ */
+
+static const char *
+formatName(cairo_format_t format) {
+  switch (format) {
+    case CAIRO_FORMAT_RGB24: return "RGB24";
+    case CAIRO_FORMAT_A8: return "A8";
+    case CAIRO_FORMAT_RGB16_565: return "RGB16_565";
+    case CAIRO_FORMAT_A1: return "A1";
+    default: return "ARGB32";
+  }
+}
+
+/*
+ * Get pixel format string.
+ */
+
+NAN_GETTER(Canvas::GetPixelFormat) {
+  Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  info.GetReturnValue().Set(Nan::New<String>(formatName(canvas->format)).ToLocalChecked());
 }
 
 /*
@@ -178,7 +294,7 @@ Canvas::EIO_ToBuffer(eio_req *req) {
   closure_t *closure = (closure_t *) req->data;
 
   closure->status = canvas_write_to_png_stream(
-      closure->canvas->surface()
+      closure->surface
     , toBuffer
     , closure);
 
@@ -237,10 +353,19 @@ NAN_METHOD(Canvas::ToBuffer) {
   uint32_t compression_level = 6;
   uint32_t filter = PNG_ALL_FILTERS;
   Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  CANVAS_CHECK_ATTACHED(canvas);
+
+#ifdef HAVE_JPEG
+  if (info[0]->IsString()
+    && 0 == strcmp("image/jpeg", *String::Utf8Value(info[0]))) {
+    return ToJPEGBuffer(info);
+  }
+#endif
 
   // TODO: async / move this out
   if (canvas->isPDF() || canvas->isSVG()) {
     cairo_surface_finish(canvas->surface());
+    canvas->trackMemory();
     closure_t *closure = (closure_t *) canvas->closure();
 
     Local<Object> buf = Nan::CopyBuffer((char*) closure->data, closure->len).ToLocalChecked();
@@ -299,13 +424,14 @@ NAN_METHOD(Canvas::ToBuffer) {
     }
 
     // TODO: only one callback fn in closure
+    closure->surface = canvas->imageSurface();
     canvas->Ref();
     closure->pfn = new Nan::Callback(info[0].As<Function>());
 
 #if NODE_VERSION_AT_LEAST(0, 6, 0)
     uv_work_t* req = new uv_work_t;
     req->data = closure;
-    uv_queue_work(uv_default_loop(), req, ToBufferAsync, (uv_after_work_cb)ToBufferAsyncAfter);
+    uv_queue_work(Nan::GetCurrentEventLoop(), req, ToBufferAsync, (uv_after_work_cb)ToBufferAsyncAfter);
 #else
     eio_custom(EIO_ToBuffer, EIO_PRI_DEFAULT, EIO_AfterToBuffer, closure);
     ev_ref(EV_DEFAULT_UC);
@@ -323,8 +449,10 @@ NAN_METHOD(Canvas::ToBuffer) {
       return Nan::ThrowError(Canvas::Error(status));
     }
 
+    closure.surface = canvas->imageSurface();
+
     TryCatch try_catch;
-    status = canvas_write_to_png_stream(canvas->surface(), toBuffer, &closure);
+    status = canvas_write_to_png_stream(closure.surface, toBuffer, &closure);
 
     if (try_catch.HasCaught()) {
       closure_destroy(&closure);
@@ -342,6 +470,149 @@ NAN_METHOD(Canvas::ToBuffer) {
   }
 }
 
+#ifdef HAVE_JPEG
+
+/*
+ * JPEG toBuffer worker.
+ */
+
+void
+Canvas::ToJPEGBufferAsync(uv_work_t *req) {
+  closure_t *closure = (closure_t *) req->data;
+  closure->status = write_to_jpeg_buffer(closure->surface, closure);
+}
+
+/*
+ * JPEG toBuffer completion, invoking the callback with
+ * (err, buf, quality).
+ */
+
+void
+Canvas::ToJPEGBufferAsyncAfter(uv_work_t *req) {
+  Nan::HandleScope scope;
+  closure_t *closure = (closure_t *) req->data;
+  delete req;
+
+  if (closure->status) {
+    Local<Value> argv[1] = { Canvas::Error(closure->status) };
+    closure->pfn->Call(1, argv);
+  } else if (!closure->quality) {
+    Local<Value> argv[1] = { Nan::Error("JPEG does not fit within maxBytes") };
+    closure->pfn->Call(1, argv);
+  } else {
+    Local<Object> buf = Nan::CopyBuffer((char *)closure->data, closure->len).ToLocalChecked();
+    buf->Set(Nan::New<String>("quality").ToLocalChecked(), Nan::New<Uint32>(closure->quality));
+    Local<Value> argv[3] = { Nan::Null(), buf, Nan::New<Uint32>(closure->quality) };
+    closure->pfn->Call(3, argv);
+  }
+
+  closure->canvas->Unref();
+  delete closure->pfn;
+  closure_destroy(closure);
+  free(closure);
+}
+
+/*
+ * Encode JPEG data to a node::Buffer:
+ *
+ *   toBuffer('image/jpeg'[, { quality, progressive, maxBytes }][, fn])
+ *
+ * When `maxBytes` is given the highest quality (up to `quality`)
+ * producing no more than `maxBytes` is chosen. The quality used is
+ * exposed as `buf.quality`.
+ */
+
+NAN_METHOD(Canvas::ToJPEGBuffer) {
+  Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  CANVAS_CHECK_ATTACHED(canvas);
+  uint32_t quality = 75;
+  uint32_t max_bytes = 0;
+  bool progressive = false;
+  cairo_status_t status;
+
+  if (canvas->isPDF() || canvas->isSVG())
+    return Nan::ThrowTypeError("wrong canvas type");
+
+  Local<Value> fn = info[1]->IsFunction() ? info[1] : info[2];
+
+  if (info[1]->IsObject() && !info[1]->IsFunction()) {
+    Local<Object> opts = info[1]->ToObject();
+    Local<Value> q = opts->Get(Nan::New<String>("quality").ToLocalChecked());
+    Local<Value> p = opts->Get(Nan::New<String>("progressive").ToLocalChecked());
+    Local<Value> m = opts->Get(Nan::New<String>("maxBytes").ToLocalChecked());
+
+    if (!q->IsUndefined()) {
+      if (!q->IsNumber())
+        return Nan::ThrowTypeError("quality must be a number");
+      double n = q->NumberValue();
+      quality = n < 1 ? 1 : n > 100 ? 100 : n;
+    }
+
+    progressive = p->BooleanValue();
+
+    if (!m->IsUndefined()) {
+      // 0 is the internal "no limit", so it's not a valid budget
+      if (!m->IsNumber() || !(m->NumberValue() >= 1))
+        return Nan::ThrowTypeError("maxBytes must be a positive number");
+      double n = m->NumberValue();
+      max_bytes = n > UINT32_MAX ? UINT32_MAX : n;
+    }
+  }
+
+  // Async
+  if (fn->IsFunction()) {
+    closure_t *closure = (closure_t *) malloc(sizeof(closure_t));
+    status = closure_init(closure, canvas, 0, PNG_NO_FILTERS);
+
+    if (status) {
+      closure_destroy(closure);
+      free(closure);
+      return Nan::ThrowError(Canvas::Error(status));
+    }
+
+    closure->quality = quality;
+    closure->max_bytes = max_bytes;
+    closure->progressive = progressive;
+    closure->surface = canvas->imageSurface(true);
+
+    canvas->Ref();
+    closure->pfn = new Nan::Callback(fn.As<Function>());
+
+    uv_work_t* req = new uv_work_t;
+    req->data = closure;
+    uv_queue_work(Nan::GetCurrentEventLoop(), req, ToJPEGBufferAsync, (uv_after_work_cb)ToJPEGBufferAsyncAfter);
+    return;
+
+  // Sync
+  } else {
+    closure_t closure;
+    status = closure_init(&closure, canvas, 0, PNG_NO_FILTERS);
+
+    if (!status) {
+      closure.quality = quality;
+      closure.max_bytes = max_bytes;
+      closure.progressive = progressive;
+      closure.surface = canvas->imageSurface(true);
+      status = write_to_jpeg_buffer(closure.surface, &closure);
+    }
+
+    if (status) {
+      closure_destroy(&closure);
+      return Nan::ThrowError(Canvas::Error(status));
+    } else if (!closure.quality) {
+      closure_destroy(&closure);
+      return Nan::ThrowError("JPEG does not fit within maxBytes");
+    }
+
+    Local<Object> buf = Nan::CopyBuffer((char *)closure.data, closure.len).ToLocalChecked();
+    buf->Set(Nan::New<String>("quality").ToLocalChecked(), Nan::New<Uint32>(closure.quality));
+    closure_destroy(&closure);
+    info.GetReturnValue().Set(buf);
+  }
+}
+
+#endif
+
 /*
  * Canvas::StreamPNG callback.
  */
@@ -410,14 +681,17 @@ NAN_METHOD(Canvas::StreamPNGSync) {
 
 
   Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  CANVAS_CHECK_ATTACHED(canvas);
   closure_t closure;
   closure.fn = Local<Function>::Cast(info[0]);
   closure.compression_level = compression_level;
   closure.filter = filter;
 
+  cairo_surface_t *surface = canvas->imageSurface();
   TryCatch try_catch;
 
-  cairo_status_t status = canvas_write_to_png_stream(canvas->surface(), streamPNG, &closure);
+  cairo_status_t status = canvas_write_to_png_stream(surface, streamPNG, &closure);
+  cairo_surface_destroy(surface);
 
   if (try_catch.HasCaught()) {
     try_catch.ReThrow();
@@ -489,6 +763,7 @@ NAN_METHOD(Canvas::StreamPDFSync) {
     return Nan::ThrowTypeError("wrong canvas type");
 
   cairo_surface_finish(canvas->surface());
+  canvas->trackMemory();
 
   closure_t closure;
   closure.data = static_cast<closure_t *>(canvas->closure())->data;
@@ -531,11 +806,17 @@ NAN_METHOD(Canvas::StreamJPEGSync) {
     return Nan::ThrowTypeError("callback function required");
 
   Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  CANVAS_CHECK_ATTACHED(canvas);
   closure_t closure;
   closure.fn = Local<Function>::Cast(info[3]);
 
+  if (canvas->isPDF() || canvas->isSVG())
+    return Nan::ThrowTypeError("wrong canvas type");
+
+  cairo_surface_t *surface = canvas->imageSurface(true);
   TryCatch try_catch;
-  write_to_jpeg_stream(canvas->surface(), info[0]->NumberValue(), info[1]->NumberValue(), info[2]->BooleanValue(), &closure);
+  write_to_jpeg_stream(surface, info[0]->NumberValue(), info[1]->NumberValue(), info[2]->BooleanValue(), &closure);
+  cairo_surface_destroy(surface);
 
   if (try_catch.HasCaught()) {
     try_catch.ReThrow();
@@ -545,16 +826,542 @@ NAN_METHOD(Canvas::StreamJPEGSync) {
 
 #endif
 
+/*
+ * Release the pixels of an image canvas to the surface pool,
+ * leaving it 0x0.
+ */
+
+NAN_METHOD(Canvas::Release) {
+  Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  if (CANVAS_TYPE_IMAGE != canvas->type || canvas->isExternal()) return;
+  canvas->width = canvas->height = 0;
+  canvas->resurface(info.This());
+}
+
+/*
+ * Free the surface of the canvas right away, leaving it 0x0.
+ */
+
+NAN_METHOD(Canvas::Dispose) {
+  Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  canvas->width = canvas->height = 0;
+  canvas->resurface(info.This(), true);
+}
+
+/*
+ * Complete pending drawing, so that readers of the pixels,
+ * such as the owner of an external buffer, see all of it.
+ */
+
+NAN_METHOD(Canvas::Flush) {
+  Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  if (canvas->_surface) cairo_surface_flush(canvas->_surface);
+}
+
+/*
+ * Return a new image canvas with a copy of the pixels, shared
+ * copy-on-write where supported.
+ */
+
+NAN_METHOD(Canvas::Clone) {
+  Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  CANVAS_CHECK_ATTACHED(canvas);
+  if (CANVAS_TYPE_IMAGE != canvas->type)
+    return Nan::ThrowTypeError("clone() is only supported by image canvases");
+
+  Local<Object> options = Nan::New<Object>();
+  Nan::Set(options
+    , Nan::New("pixelFormat").ToLocalChecked()
+    , Nan::New<String>(formatName(canvas->format)).ToLocalChecked());
+  Local<Value> argv[3] = { Nan::New<Number>(0), Nan::New<Number>(0), options };
+  Local<Object> instance = constructor.Get()->GetFunction()->NewInstance(3, argv);
+
+  cairo_surface_t *surface = canvas_snapshot_clone(canvas->surface()
+    , (canvas_snapshot_t **) &canvas->_snapshot);
+  canvas->trackMemory();
+  if (cairo_surface_status(surface)) {
+    cairo_status_t status = cairo_surface_status(surface);
+    cairo_surface_destroy(surface);
+    return Nan::ThrowError(Canvas::Error(status));
+  }
+
+  Nan::ObjectWrap::Unwrap<Canvas>(instance)->adopt(surface);
+  info.GetReturnValue().Set(instance);
+}
+
+/*
+ * Free a transferred surface once its ArrayBuffer is collected.
+ */
+
+static cairo_surface_t *backing_surface(cairo_surface_t *surface);
+
+#if NODE_MODULE_VERSION >= 83
+static void
+transfer_free(void *data, size_t length, void *surface) {
+  cairo_surface_destroy((cairo_surface_t *) surface);
+}
+#endif
+
+/*
+ * Detach the pixels of an image canvas, leaving it 0x0. Returns
+ * { width, height, pixelFormat, stride, buffer }, where `buffer` is an
+ * ArrayBuffer over the surface memory, or over a copy while the memory
+ * is shared, that can be transferred to another thread and passed back
+ * to the Canvas constructor there.
+ */
+
+NAN_METHOD(Canvas::Transfer) {
+  Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  if (CANVAS_TYPE_IMAGE != canvas->type || canvas->isExternal())
+    return Nan::ThrowTypeError("transfer() is only supported by image canvases that own their pixels");
+
+  // The context lets go of the surface first, so that
+  // only the canvas should still reference it
+  Local<Value> context = info.This()->Get(Nan::New<String>("context").ToLocalChecked());
+  if (!context->IsUndefined())
+    Nan::ObjectWrap::Unwrap<Context2d>(context->ToObject())->resetContext();
+
+  cairo_surface_t *surface = canvas->surface();
+  cairo_surface_flush(surface);
+  size_t len = (size_t) canvas->stride() * canvas->height;
+
+  Local<Object> frame = Nan::New<Object>();
+  Nan::Set(frame, Nan::New("width").ToLocalChecked(), Nan::New<Number>(canvas->width));
+  Nan::Set(frame, Nan::New("height").ToLocalChecked(), Nan::New<Number>(canvas->height));
+  Nan::Set(frame
+    , Nan::New("pixelFormat").ToLocalChecked()
+    , Nan::New<String>(formatName(canvas->format)).ToLocalChecked());
+  Nan::Set(frame, Nan::New("stride").ToLocalChecked(), Nan::New<Number>(canvas->stride()));
+
+  Local<ArrayBuffer> buffer;
+#if NODE_MODULE_VERSION >= 83
+  // Hand the memory over only when nothing else may still use it, an
+  // async encoder for instance, and copy surfaces resized in place
+  if (1 == cairo_surface_get_reference_count(surface)
+    && backing_surface(surface) == surface) {
+    std::unique_ptr<BackingStore> store = ArrayBuffer::NewBackingStore(
+      canvas->data(), len, transfer_free, surface);
+    buffer = ArrayBuffer::New(Isolate::GetCurrent(), std::move(store));
+    canvas->_surface = NULL;
+  } else {
+    buffer = ArrayBuffer::New(Isolate::GetCurrent(), len);
+    memcpy(buffer->GetBackingStore()->Data(), canvas->data(), len);
+  }
+#else
+  // Copy where external backing stores aren't available
+  buffer = ArrayBuffer::New(Isolate::GetCurrent(), len);
+  memcpy(buffer->GetContents().Data(), canvas->data(), len);
+#endif
+  Nan::Set(frame, Nan::New("buffer").ToLocalChecked(), buffer);
+
+  canvas->width = canvas->height = 0;
+  canvas->resurface(info.This(), true);
+  info.GetReturnValue().Set(frame);
+}
+
+/*
+ * Append `x, y, width, height` to `regions`, split into `tile`
+ * sized tiles when set, and limited to `width` by `height`.
+ */
+
+static void
+push_region(Local<Array> regions, int x, int y, int w, int h, int tile, int width, int height) {
+  int stepX = tile ? tile : w
+    , stepY = tile ? tile : h;
+  for (int ty = y; ty < y + h && ty < height; ty += stepY) {
+    for (int tx = x; tx < x + w && tx < width; tx += stepX) {
+      Local<Object> region = Nan::New<Object>();
+      Nan::Set(region, Nan::New("x").ToLocalChecked(), Nan::New<Number>(tx));
+      Nan::Set(region, Nan::New("y").ToLocalChecked(), Nan::New<Number>(ty));
+      Nan::Set(region, Nan::New("width").ToLocalChecked()
+        , Nan::New<Number>((std::min)(stepX, width - tx)));
+      Nan::Set(region, Nan::New("height").ToLocalChecked()
+        , Nan::New<Number>((std::min)(stepY, height - ty)));
+      Nan::Set(regions, regions->Length(), region);
+    }
+  }
+}
+
+/*
+ * Return the areas changed since the last clearDirty() as disjoint
+ * { x, y, width, height } rectangles, or as the tiles of a
+ * `tileSize` grid that they touch.
+ */
+
+NAN_METHOD(Canvas::GetDirtyRegions) {
+  Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  int tile = 0;
+  if (!info[0]->IsUndefined()) {
+    if (!info[0]->IsNumber() || info[0]->NumberValue() < 1)
+      return Nan::ThrowTypeError("tileSize must be a positive number");
+    double size = info[0]->NumberValue();
+    if (!std::isfinite(size))
+      return Nan::ThrowRangeError("tileSize must be finite");
+    // A tile covering the canvas holds all of it, and
+    // keeps the grid arithmetic below within int range
+    tile = (int) (std::min)(size
+      , (double) (std::max)((std::max)(canvas->width, canvas->height), 1));
+  }
+
+  Local<Array> regions = Nan::New<Array>();
+#if CAIRO_VERSION_MINOR >= 10
+  cairo_region_t *dirty = canvas->_dirty;
+  if (tile) {
+    // Snap to the grid, merging rectangles that share tiles
+    dirty = cairo_region_create();
+    for (int i = 0, n = cairo_region_num_rectangles(canvas->_dirty); i < n; ++i) {
+      cairo_rectangle_int_t rect;
+      cairo_region_get_rectangle(canvas->_dirty, i, &rect);
+      int x2 = (rect.x + rect.width + tile - 1) / tile * tile
+        , y2 = (rect.y + rect.height + tile - 1) / tile * tile;
+      rect.x = rect.x / tile * tile;
+      rect.y = rect.y / tile * tile;
+      rect.width = x2 - rect.x;
+      rect.height = y2 - rect.y;
+      cairo_region_union_rectangle(dirty, &rect);
+    }
+  }
+
+  for (int i = 0, n = cairo_region_num_rectangles(dirty); i < n; ++i) {
+    cairo_rectangle_int_t rect;
+    cairo_region_get_rectangle(dirty, i, &rect);
+    push_region(regions, rect.x, rect.y, rect.width, rect.height
+      , tile, canvas->width, canvas->height);
+  }
+  if (dirty != canvas->_dirty) cairo_region_destroy(dirty);
+#else
+  // Without regions the whole canvas is reported
+  push_region(regions, 0, 0, canvas->width, canvas->height
+    , tile, canvas->width, canvas->height);
+#endif
+  info.GetReturnValue().Set(regions);
+}
+
+/*
+ * Forget the changed areas, after they have been exported.
+ */
+
+NAN_METHOD(Canvas::ClearDirty) {
+#if CAIRO_VERSION_MINOR >= 10
+  Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(info.This());
+  cairo_region_destroy(canvas->_dirty);
+  canvas->_dirty = cairo_region_create();
+#endif
+}
+
+/*
+ * Return the surface pool statistics.
+ */
+
+NAN_METHOD(Canvas::SurfacePoolStats) {
+  uint32_t hits, misses, size;
+  size_t bytes;
+  surface_pool_stats(&hits, &misses, &size, &bytes);
+
+  Local<Object> stats = Nan::New<Object>();
+  Nan::Set(stats, Nan::New("hits").ToLocalChecked(), Nan::New<Number>(hits));
+  Nan::Set(stats, Nan::New("misses").ToLocalChecked(), Nan::New<Number>(misses));
+  Nan::Set(stats, Nan::New("size").ToLocalChecked(), Nan::New<Number>(size));
+  Nan::Set(stats, Nan::New("bytes").ToLocalChecked(), Nan::New<Number>(bytes));
+  Nan::Set(stats, Nan::New("limit").ToLocalChecked(), Nan::New<Number>(surface_pool_limit()));
+  info.GetReturnValue().Set(stats);
+}
+
+/*
+ * Set the surface pool byte limit, 0 disables pooling.
+ */
+
+NAN_METHOD(Canvas::SetSurfacePoolLimit) {
+  double limit = info[0]->NumberValue();
+  if (!info[0]->IsNumber() || !(limit >= 0))
+    return Nan::ThrowTypeError("limit must be a positive number");
+  // Infinity and anything past SIZE_MAX lift the limit
+  surface_pool_set_limit(limit >= (double) SIZE_MAX ? SIZE_MAX : (size_t) limit);
+}
+
+/*
+ * Image surfaces resized in place are views of the surface that
+ * owns the memory, which they keep alive under this key.
+ */
+
+static cairo_user_data_key_t backing_key;
+
+static cairo_surface_t *
+backing_surface(cairo_surface_t *surface) {
+  cairo_surface_t *backing = (cairo_surface_t *) cairo_surface_get_user_data(surface, &backing_key);
+  return backing ? backing : surface;
+}
+
+/*
+ * Return a new reference to a cleared `width` by `height` surface
+ * over the memory of `surface` when it fits, at the same stride, or
+ * NULL. Same-sized surfaces are cleared and returned as is. The caller
+ * must hold the only reference to `surface`, otherwise the memory may
+ * still be read, by an async encoder for instance, and NULL is returned.
+ */
+
+static cairo_surface_t *
+resize_in_place(cairo_surface_t *surface, cairo_format_t format, int width, int height) {
+  cairo_surface_t *backing = backing_surface(surface);
+  if (1 != cairo_surface_get_reference_count(surface)
+    || 1 != cairo_surface_get_reference_count(backing)) return NULL;
+  if (!width || !height
+    || format != cairo_image_surface_get_format(backing)
+    || width > cairo_image_surface_get_width(backing)
+    || height > cairo_image_surface_get_height(backing)) return NULL;
+
+  cairo_surface_t *resized;
+  if (width == cairo_image_surface_get_width(surface)
+    && height == cairo_image_surface_get_height(surface)) {
+    resized = cairo_surface_reference(surface);
+  } else if (width == cairo_image_surface_get_width(backing)
+    && height == cairo_image_surface_get_height(backing)) {
+    resized = cairo_surface_reference(backing);
+  } else {
+    resized = cairo_image_surface_create_for_data(
+        cairo_image_surface_get_data(backing)
+      , format
+      , width
+      , height
+      , cairo_image_surface_get_stride(backing));
+    if (cairo_surface_status(resized)
+      || cairo_surface_set_user_data(resized, &backing_key
+        , cairo_surface_reference(backing), (cairo_destroy_func_t) cairo_surface_destroy)) {
+      cairo_surface_destroy(resized);
+      return NULL;
+    }
+  }
+
+  cairo_surface_flush(resized);
+  memset(cairo_image_surface_get_data(resized), 0
+    , (size_t) cairo_image_surface_get_stride(resized) * height);
+  cairo_surface_mark_dirty(resized);
+  return resized;
+}
+
+/*
+ * Release an owned image surface to the pool, the memory
+ * it views when it was resized in place.
+ */
+
+static void
+release_surface(cairo_surface_t *surface) {
+  if (!surface) return;
+  cairo_surface_t *backing = backing_surface(surface);
+  if (backing != surface) {
+    cairo_surface_reference(backing);
+    cairo_surface_destroy(surface);
+  }
+  surface_pool_destroy(backing);
+}
+
+/*
+ * Canvas.diff() state, shared with the threadpool when async.
+ */
+
+typedef struct {
+  cairo_surface_t *a;
+  cairo_surface_t *b;
+  cairo_surface_t *out;
+  int threshold;
+  canvas_diff_t result;
+  Nan::Callback *pfn;
+} diff_closure_t;
+
+/*
+ * Return a new reference to the pixels of a canvas that can be
+ * diffed, or NULL.
+ */
+
+static cairo_surface_t *
+diff_surface(Local<Value> value) {
+  if (!value->IsObject() || !Canvas::constructor.Get()->HasInstance(value))
+    return NULL;
+  Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(value->ToObject());
+  if ((CANVAS_TYPE_IMAGE != canvas->type && !canvas->tiled)
+    || (CAIRO_FORMAT_ARGB32 != canvas->format && CAIRO_FORMAT_RGB24 != canvas->format))
+    return NULL;
+  return canvas->imageSurface();
+}
+
+/*
+ * { count, bounds, diff } of a finished comparison, where `bounds` is
+ * null when the canvases match and `diff` only present when requested.
+ * Releases the closure's surfaces.
+ */
+
+static Local<Object>
+diff_result(diff_closure_t *closure) {
+  Nan::EscapableHandleScope scope;
+  canvas_diff_t *r = &closure->result;
+  Local<Object> result = Nan::New<Object>();
+  Nan::Set(result, Nan::New("count").ToLocalChecked(), Nan::New<Number>(r->count));
+
+  if (r->count) {
+    Local<Object> bounds = Nan::New<Object>();
+    Nan::Set(bounds, Nan::New("x").ToLocalChecked(), Nan::New<Number>(r->x1));
+    Nan::Set(bounds, Nan::New("y").ToLocalChecked(), Nan::New<Number>(r->y1));
+    Nan::Set(bounds, Nan::New("width").ToLocalChecked(), Nan::New<Number>(r->x2 - r->x1));
+    Nan::Set(bounds, Nan::New("height").ToLocalChecked(), Nan::New<Number>(r->y2 - r->y1));
+    Nan::Set(result, Nan::New("bounds").ToLocalChecked(), bounds);
+  } else {
+    Nan::Set(result, Nan::New("bounds").ToLocalChecked(), Nan::Null());
+  }
+
+  if (closure->out) {
+    cairo_surface_mark_dirty(closure->out);
+    Local<Value> argv[2] = { Nan::New<Number>(0), Nan::New<Number>(0) };
+    Local<Object> instance = Canvas::constructor.Get()->GetFunction()->NewInstance(2, argv);
+    Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(instance);
+    canvas->adopt(closure->out);
+    Nan::Set(result, Nan::New("diff").ToLocalChecked(), instance);
+  }
+
+  cairo_surface_destroy(closure->a);
+  cairo_surface_destroy(closure->b);
+  return scope.Escape(result);
+}
+
+/*
+ * Compare on the threadpool.
+ */
+
+void
+Canvas::DiffAsync(uv_work_t *req) {
+  diff_closure_t *closure = (diff_closure_t *) req->data;
+  canvas_diff(closure->a, closure->b, closure->threshold, closure->out, &closure->result);
+}
+
+/*
+ * Invoke the callback with (null, result).
+ */
+
+void
+Canvas::DiffAsyncAfter(uv_work_t *req) {
+  Nan::HandleScope scope;
+  diff_closure_t *closure = (diff_closure_t *) req->data;
+  delete req;
+
+  Local<Value> argv[2] = { Nan::Null(), diff_result(closure) };
+  closure->pfn->Call(2, argv);
+
+  delete closure->pfn;
+  delete closure;
+}
+
+/*
+ * Compare the pixels of two image canvases of the same size and
+ * ARGB32 or RGB24 format:
+ *
+ *   Canvas.diff(a, b[, { threshold, diff }][, fn])
+ *
+ * Pixels differ when a channel differs by more than `threshold`,
+ * 0 by default. With `diff` set the result includes a canvas with
+ * the differing pixels in red. Async when a callback is passed.
+ */
+
+NAN_METHOD(Canvas::Diff) {
+  int argc = info.Length();
+  Local<Function> fn;
+  if (argc && info[argc - 1]->IsFunction()) fn = info[--argc].As<Function>();
+
+  int threshold = 0;
+  bool output = false;
+  if (argc > 2 && info[2]->IsObject()) {
+    Local<Object> options = info[2]->ToObject();
+    Local<Value> value = options->Get(Nan::New("threshold").ToLocalChecked());
+    if (!value->IsUndefined()) {
+      if (!value->IsNumber() || value->NumberValue() < 0 || value->NumberValue() > 255)
+        return Nan::ThrowRangeError("threshold must be between 0 and 255");
+      threshold = value->Int32Value();
+    }
+    output = options->Get(Nan::New("diff").ToLocalChecked())->BooleanValue();
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    if (info[i]->IsObject() && Canvas::constructor.Get()->HasInstance(info[i]))
+      CANVAS_CHECK_ATTACHED(Nan::ObjectWrap::Unwrap<Canvas>(info[i]->ToObject()));
+  }
+
+  cairo_surface_t *a = diff_surface(info[0])
+    , *b = diff_surface(info[1]);
+  if (!a || !b) {
+    cairo_surface_destroy(a);
+    cairo_surface_destroy(b);
+    return Nan::ThrowTypeError("ARGB32 or RGB24 image canvases expected");
+  }
+
+  if (cairo_image_surface_get_format(a) != cairo_image_surface_get_format(b)
+    || cairo_image_surface_get_width(a) != cairo_image_surface_get_width(b)
+    || cairo_image_surface_get_height(a) != cairo_image_surface_get_height(b)) {
+    cairo_surface_destroy(a);
+    cairo_surface_destroy(b);
+    return Nan::ThrowRangeError("canvases must have the same size and pixel format");
+  }
+
+  diff_closure_t *closure = new diff_closure_t;
+  closure->a = a;
+  closure->b = b;
+  closure->out = NULL;
+  closure->threshold = threshold;
+  closure->pfn = NULL;
+
+  if (output) {
+    closure->out = cairo_image_surface_create(CAIRO_FORMAT_ARGB32
+      , cairo_image_surface_get_width(a)
+      , cairo_image_surface_get_height(a));
+    cairo_status_t status = cairo_surface_status(closure->out);
+    if (status) {
+      cairo_surface_destroy(closure->out);
+      cairo_surface_destroy(a);
+      cairo_surface_destroy(b);
+      delete closure;
+      return Nan::ThrowError(Canvas::Error(status));
+    }
+  }
+
+  // cairo state is only touched here, canvas_diff() reads plain memory
+  cairo_surface_flush(a);
+  cairo_surface_flush(b);
+  if (closure->out) cairo_surface_flush(closure->out);
+
+  // Async
+  if (!fn.IsEmpty()) {
+    closure->pfn = new Nan::Callback(fn);
+    uv_work_t *req = new uv_work_t;
+    req->data = closure;
+    uv_queue_work(Nan::GetCurrentEventLoop(), req, DiffAsync, (uv_after_work_cb) DiffAsyncAfter);
+    return;
+  }
+
+  // Sync
+  canvas_diff(a, b, threshold, closure->out, &closure->result);
+  info.GetReturnValue().Set(diff_result(closure));
+  delete closure;
+}
+
 /*
  * Initialize cairo surface.
  */
 
-Canvas::Canvas(int w, int h, canvas_type_t t): Nan::ObjectWrap() {
+Canvas::Canvas(int w, int h, canvas_type_t t, cairo_format_t f, Local<Object> buffer, int stride): Nan::ObjectWrap() {
   type = t;
+  format = f;
+  tiled = false;
+  drawsSurfaces = false;
   width = w;
   height = h;
   _surface = NULL;
+  _raster = NULL;
+  _base = NULL;
+  _pending = false;
   _closure = NULL;
+  _snapshot = NULL;
+  _memory = 0;
+#if CAIRO_VERSION_MINOR >= 10
+  _dirty = NULL;
+#endif
+  damageAll();
 
   if (CANVAS_TYPE_PDF == t) {
     _closure = malloc(sizeof(closure_t));
@@ -568,11 +1375,70 @@ Canvas::Canvas(int w, int h, canvas_type_t t): Nan::ObjectWrap() {
     cairo_status_t status = closure_init((closure_t *) _closure, this, 0, PNG_NO_FILTERS);
     assert(status == CAIRO_STATUS_SUCCESS);
     _surface = cairo_svg_surface_create_for_stream(toBuffer, _closure, w, h);
-  } else {
-    _surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+#if CAIRO_VERSION_MINOR >= 10
+  } else if (CANVAS_TYPE_RECORDING == t) {
+    cairo_rectangle_t extents = { 0, 0, (double) w, (double) h };
+    _surface = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+    assert(_surface);
+#endif
+  } else if (!buffer.IsEmpty()) {
+    Nan::TypedArrayContents<uint8_t> contents(buffer);
+    _buffer.Reset(buffer);
+#if NODE_MODULE_VERSION >= 83
+    // The backing store keeps the memory alive should the
+    // buffer be detached, by a transfer to a worker for instance
+    _store = buffer.As<ArrayBufferView>()->Buffer()->GetBackingStore();
+#endif
+    _surface = cairo_image_surface_create_for_data(*contents, format, w, h, stride);
     assert(_surface);
-    Nan::AdjustExternalMemory(4 * w * h);
   }
+
+  // Image surfaces are allocated when first used
+  trackMemory();
+}
+
+/*
+ * Take over `surface`, an image surface in the format of the
+ * canvas, as its pixels.
+ */
+
+void
+Canvas::adopt(cairo_surface_t *surface) {
+  release_surface(_surface);
+  _surface = surface;
+  width = cairo_image_surface_get_width(surface);
+  height = cairo_image_surface_get_height(surface);
+  damageAll();
+  trackMemory();
+}
+
+/*
+ * Allocate the surface of an image canvas.
+ */
+
+void
+Canvas::allocate() {
+  _surface = surface_pool_create(format, width, height);
+  assert(_surface);
+  trackMemory();
+}
+
+/*
+ * Whether the caller-provided buffer no longer holds the pixels, once
+ * detached by a transfer. Canvases hold on to the backing store where
+ * V8 exposes it, so only older versions can lose their memory.
+ */
+
+bool
+Canvas::isDetached() {
+#if NODE_MODULE_VERSION >= 83
+  return false;
+#else
+  if (!isExternal()) return false;
+  Nan::TypedArrayContents<uint8_t> contents(Nan::New(_buffer));
+  return (size_t) cairo_image_surface_get_stride(_surface)
+    * cairo_image_surface_get_height(_surface) > contents.length();
+#endif
 }
 
 /*
@@ -588,60 +1454,326 @@ Canvas::~Canvas() {
       free(_closure);
       cairo_surface_destroy(_surface);
       break;
-    case CANVAS_TYPE_IMAGE:
+    case CANVAS_TYPE_RECORDING:
       cairo_surface_destroy(_surface);
-      Nan::AdjustExternalMemory(-4 * width * height);
+      cairo_surface_destroy(_raster);
+      cairo_surface_destroy(_base);
+      break;
+    case CANVAS_TYPE_IMAGE:
+      if (isExternal()) cairo_surface_destroy(_surface);
+      else release_surface(_surface);
+      _buffer.Reset();
+#if NODE_MODULE_VERSION >= 83
+      _store.reset();
+#endif
       break;
   }
+
+  canvas_snapshot_destroy((canvas_snapshot_t *) _snapshot);
+#if CAIRO_VERSION_MINOR >= 10
+  cairo_region_destroy(_dirty);
+#endif
+  Nan::AdjustExternalMemory(-_memory);
 }
 
 /*
- * Re-alloc the surface, destroying the previous.
+ * Re-alloc the surface, destroying the previous. Image canvases clear
+ * their memory in place when the new size fits in it, and otherwise
+ * allocate on next use. When `dispose` is set the previous surface and
+ * output are freed rather than pooled or kept.
  */
 
 void
-Canvas::resurface(Local<Object> canvas) {
+Canvas::resurface(Local<Object> canvas, bool dispose) {
   Nan::HandleScope scope;
   Local<Value> context;
   switch (type) {
     case CANVAS_TYPE_PDF:
-      cairo_pdf_surface_set_size(_surface, width, height);
-      break;
+      if (!dispose) {
+        cairo_pdf_surface_set_size(_surface, width, height);
+        break;
+      }
+      // fall through
     case CANVAS_TYPE_SVG:
       // Re-surface
       cairo_surface_finish(_surface);
       closure_destroy((closure_t *) _closure);
       cairo_surface_destroy(_surface);
       closure_init((closure_t *) _closure, this, 0, PNG_NO_FILTERS);
-      _surface = cairo_svg_surface_create_for_stream(toBuffer, _closure, width, height);
+      _surface = isPDF()
+        ? cairo_pdf_surface_create_for_stream(toBuffer, _closure, width, height)
+        : cairo_svg_surface_create_for_stream(toBuffer, _closure, width, height);
 
       // Reset context
       context = canvas->Get(Nan::New<String>("context").ToLocalChecked());
-      if (!context->IsUndefined()) {
-        Context2d *context2d = Nan::ObjectWrap::Unwrap<Context2d>(context->ToObject());
-        cairo_t *prev = context2d->context();
-        context2d->setContext(cairo_create(surface()));
-        cairo_destroy(prev);
+      if (!context->IsUndefined())
+        Nan::ObjectWrap::Unwrap<Context2d>(context->ToObject())->resetContext();
+      break;
+    case CANVAS_TYPE_RECORDING:
+#if CAIRO_VERSION_MINOR >= 10
+      {
+        // Re-surface, discarding the recorded operations
+        cairo_rectangle_t extents = { 0, 0, (double) width, (double) height };
+        cairo_surface_destroy(_surface);
+        _surface = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+        drawsSurfaces = false;
       }
+
+      // Reset context
+      context = canvas->Get(Nan::New<String>("context").ToLocalChecked());
+      if (!context->IsUndefined())
+        Nan::ObjectWrap::Unwrap<Context2d>(context->ToObject())->resetContext();
+
+      // Nothing records over the pixels of the last read anymore
+      cairo_surface_destroy(_raster);
+      cairo_surface_destroy(_base);
+      _raster = _base = NULL;
+#endif
       break;
     case CANVAS_TYPE_IMAGE:
       // Re-surface
-      int old_width = cairo_image_surface_get_width(_surface);
-      int old_height = cairo_image_surface_get_height(_surface);
-      cairo_surface_destroy(_surface);
-      _surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-      Nan::AdjustExternalMemory(4 * (width * height - old_width * old_height));
+      if (isExternal() && !dispose) {
+        // External memory is reused, cleared, at the same stride
+        int stride = this->stride();
+        uint8_t *data = this->data();
+        if (isDetached()) {
+          width = cairo_image_surface_get_width(_surface);
+          height = cairo_image_surface_get_height(_surface);
+          return Nan::ThrowTypeError("canvas buffer has been detached");
+        }
+#if NODE_MODULE_VERSION >= 83
+        size_t length = (uint8_t *) _store->Data() + _store->ByteLength() - data;
+#else
+        size_t length = Nan::TypedArrayContents<uint8_t>(Nan::New(_buffer)).length();
+#endif
+        if (cairo_format_stride_for_width(format, width) > stride
+          || (size_t) stride * height > length) {
+          width = cairo_image_surface_get_width(_surface);
+          height = cairo_image_surface_get_height(_surface);
+          return Nan::ThrowRangeError("canvas size exceeds its buffer");
+        }
+        cairo_surface_destroy(_surface);
+        memset(data, 0, (size_t) stride * height);
+        _surface = cairo_image_surface_create_for_data(data, format, width, height, stride);
+      } else {
+        cairo_surface_t *prev = _surface;
+        _surface = NULL;
+        if (dispose) {
+          canvas_snapshot_destroy((canvas_snapshot_t *) _snapshot);
+          _snapshot = NULL;
+          cairo_surface_destroy(prev);
+        } else if (prev) {
+          // The context lets go of the surface first, so that
+          // only the canvas should still reference it
+          context = canvas->Get(Nan::New<String>("context").ToLocalChecked());
+          if (!context->IsUndefined())
+            Nan::ObjectWrap::Unwrap<Context2d>(context->ToObject())->resetContext();
+
+          // Same size or smaller keeps the memory, cleared
+          _surface = resize_in_place(prev, format, width, height);
+          if (_surface) cairo_surface_destroy(prev);
+          else release_surface(prev);
+        }
+        _buffer.Reset();
+#if NODE_MODULE_VERSION >= 83
+        _store.reset();
+#endif
+      }
 
       // Reset context
       context = canvas->Get(Nan::New<String>("context").ToLocalChecked());
-      if (!context->IsUndefined()) {
-        Context2d *context2d = Nan::ObjectWrap::Unwrap<Context2d>(context->ToObject());
-        cairo_t *prev = context2d->context();
-        context2d->setContext(cairo_create(surface()));
-        cairo_destroy(prev);
-      }
+      if (!context->IsUndefined())
+        Nan::ObjectWrap::Unwrap<Context2d>(context->ToObject())->resetContext();
       break;
   }
+
+  damageAll();
+  trackMemory();
+}
+
+/*
+ * Mark the device space box x1, y1, x2, y2 as changed.
+ */
+
+void
+Canvas::damage(int x1, int y1, int x2, int y2) {
+#if CAIRO_VERSION_MINOR >= 10
+  cairo_rectangle_int_t rect;
+  rect.x = (std::max)(x1, 0);
+  rect.y = (std::max)(y1, 0);
+  rect.width = (std::min)(x2, width) - rect.x;
+  rect.height = (std::min)(y2, height) - rect.y;
+  if (rect.width > 0 && rect.height > 0)
+    cairo_region_union_rectangle(_dirty, &rect);
+#endif
+}
+
+/*
+ * Mark the whole canvas as changed, as when it's (re)created.
+ */
+
+void
+Canvas::damageAll() {
+#if CAIRO_VERSION_MINOR >= 10
+  cairo_rectangle_int_t rect = { 0, 0, width, height };
+  cairo_region_destroy(_dirty);
+  _dirty = cairo_region_create_rectangle(&rect);
+#endif
+}
+
+/*
+ * Report the bytes held by the surface and the clone() snapshot, or
+ * by the output buffer of PDF and SVG canvases, to V8 so that it
+ * collects large canvases promptly.
+ */
+
+void
+Canvas::trackMemory() {
+  intptr_t bytes = 0;
+  if (_closure) bytes = ((closure_t *) _closure)->max_len;
+  else if (CANVAS_TYPE_IMAGE == type && !isExternal() && _surface)
+    bytes = (intptr_t) cairo_image_surface_get_stride(backing_surface(_surface))
+      * cairo_image_surface_get_height(backing_surface(_surface));
+  if (_raster) bytes += (intptr_t) cairo_image_surface_get_stride(_raster) * height;
+  if (_base && backing_surface(_base) != _raster)
+    bytes += (intptr_t) cairo_image_surface_get_stride(_base) * height;
+  bytes += (intptr_t) canvas_snapshot_size((canvas_snapshot_t *) _snapshot);
+  if (bytes == _memory) return;
+  Nan::AdjustExternalMemory(bytes - _memory);
+  _memory = bytes;
+}
+
+/*
+ * Convert an RGB16_565, A8 or A1 surface to RGB24, masks as grayscale.
+ */
+
+static cairo_surface_t *
+to_rgb24(cairo_surface_t *surface) {
+  int width = cairo_image_surface_get_width(surface)
+    , height = cairo_image_surface_get_height(surface)
+    , stride = cairo_image_surface_get_stride(surface);
+  cairo_format_t format = cairo_image_surface_get_format(surface);
+  cairo_surface_t *rgb = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+  if (cairo_surface_status(rgb)) return rgb;
+
+  cairo_surface_flush(surface);
+  uint8_t *src = cairo_image_surface_get_data(surface)
+    , *dst = cairo_image_surface_get_data(rgb);
+  int dstStride = cairo_image_surface_get_stride(rgb);
+
+  for (int y = 0; y < height; ++y) {
+    uint8_t *row = src + y * stride;
+    uint32_t *out = (uint32_t *) (dst + y * dstStride);
+    for (int x = 0; x < width; ++x) {
+      uint32_t r, g, b;
+      if (CAIRO_FORMAT_RGB16_565 == format) {
+        uint16_t p = ((uint16_t *) row)[x];
+        r = p >> 11, g = (p >> 5) & 63, b = p & 31;
+        r = r << 3 | r >> 2;
+        g = g << 2 | g >> 4;
+        b = b << 3 | b >> 2;
+      } else if (CAIRO_FORMAT_A8 == format) {
+        r = g = b = row[x];
+      } else {
+#ifdef WORDS_BIGENDIAN
+        r = g = b = (row[x >> 3] >> (7 - (x & 7))) & 1 ? 255 : 0;
+#else
+        r = g = b = (row[x >> 3] >> (x & 7)) & 1 ? 255 : 0;
+#endif
+      }
+      out[x] = 0xff000000 | r << 16 | g << 8 | b;
+    }
+  }
+
+  cairo_surface_mark_dirty(rgb);
+  return rgb;
+}
+
+/*
+ * Return a new reference to an image surface holding the canvas
+ * pixels. Image canvases return their own surface unless its format
+ * has to be converted: RGB16_565 is always converted to RGB24, and
+ * A8 and A1 are too when `rgb` is set. Tiled canvases return their
+ * pixels as of this read, and other recordings are replayed into a
+ * fresh ARGB32 surface.
+ */
+
+cairo_surface_t *
+Canvas::imageSurface(bool rgb) {
+  if (!isRecording()) {
+    switch (format) {
+      case CAIRO_FORMAT_RGB16_565:
+        return to_rgb24(surface());
+      case CAIRO_FORMAT_A8:
+      case CAIRO_FORMAT_A1:
+        if (rgb) return to_rgb24(surface());
+        // fall through
+      default:
+        return cairo_surface_reference(surface());
+    }
+  }
+  if (tiled) return cairo_surface_reference(rasterize());
+  cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  canvas_replay_tiles(_surface, image, 0, 0, !drawsSurfaces);
+  return image;
+}
+
+/*
+ * Bring the pixels of a tiled canvas up to date with its recording,
+ * replaying it into a new surface so that earlier reads in the
+ * threadpool keep theirs. Recordings started on top of an earlier
+ * read sample its pixels, so they are replayed on a single thread.
+ */
+
+cairo_surface_t *
+Canvas::rasterize() {
+  if (isRasterized()) return _raster;
+  cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+  canvas_replay_tiles(_surface, image, 0, 0, !drawsSurfaces && !_base);
+  cairo_surface_destroy(_raster);
+  _raster = image;
+  _pending = false;
+  trackMemory();
+  return _raster;
+}
+
+/*
+ * Start a new recording of a tiled canvas on top of its pixels as of
+ * the last read, so that the next read only replays what is drawn from
+ * now on. Returns the pixels the previous recording started from, for
+ * the caller to release once nothing draws to that recording anymore,
+ * as cairo copies them out when they go first.
+ */
+
+cairo_surface_t *
+Canvas::rebase() {
+  // Record a view of the pixels, so that flushing them,
+  // as readers in the threadpool do, leaves the view alone
+  cairo_surface_t *view = cairo_image_surface_create_for_data(
+      cairo_image_surface_get_data(_raster)
+    , CAIRO_FORMAT_ARGB32
+    , width
+    , height
+    , cairo_image_surface_get_stride(_raster));
+  if (cairo_surface_set_user_data(view, &backing_key
+    , cairo_surface_reference(_raster), (cairo_destroy_func_t) cairo_surface_destroy)) {
+    cairo_surface_destroy(_raster);
+    cairo_surface_destroy(view);
+    view = cairo_surface_reference(_raster);
+  }
+
+  cairo_rectangle_t extents = { 0, 0, (double) width, (double) height };
+  cairo_surface_t *recording = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, &extents);
+  cairo_t *ctx = cairo_create(recording);
+  cairo_set_source_surface(ctx, view, 0, 0);
+  cairo_paint(ctx);
+  cairo_destroy(ctx);
+
+  cairo_surface_t *prev = _base;
+  cairo_surface_destroy(_surface);
+  _surface = recording;
+  _base = view;
+  return prev;
 }
 
 /*
@@ -20,19 +20,14 @@
 #endif
 
 #include <nan.h>
+#if NODE_MODULE_VERSION >= 83
+#include <memory>
+#endif
+#include "IsolatePersistent.h"
 
 using namespace v8;
 using namespace node;
 
-/*
- * Maxmimum states per context.
- * TODO: remove/resize
- */
-
-#ifndef CANVAS_MAX_STATES
-#define CANVAS_MAX_STATES 64
-#endif
-
 /*
  * Canvas types.
  */
@@ -40,9 +35,19 @@ using namespace node;
 typedef enum {
   CANVAS_TYPE_IMAGE,
   CANVAS_TYPE_PDF,
-  CANVAS_TYPE_SVG
+  CANVAS_TYPE_SVG,
+  CANVAS_TYPE_RECORDING
 } canvas_type_t;
 
+/*
+ * Throw from the calling method when the caller-provided
+ * buffer of `canvas` has been detached.
+ */
+
+#define CANVAS_CHECK_ATTACHED(canvas) \
+  if ((canvas)->isDetached()) \
+    return Nan::ThrowTypeError("canvas buffer has been detached")
+
 /*
  * Canvas.
  */
@@ -52,11 +57,18 @@ class Canvas: public Nan::ObjectWrap {
     int width;
     int height;
     canvas_type_t type;
-    static Nan::Persistent<FunctionTemplate> constructor;
+    cairo_format_t format;
+    bool tiled;
+    // Set once drawing samples other surfaces, so that
+    // recordings are no longer replayed in parallel
+    bool drawsSurfaces;
+    static IsolatePersistent<FunctionTemplate> constructor;
     static void Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target);
     static NAN_METHOD(New);
     static NAN_METHOD(ToBuffer);
+    static NAN_METHOD(ToJPEGBuffer);
     static NAN_GETTER(GetType);
+    static NAN_GETTER(GetPixelFormat);
     static NAN_GETTER(GetWidth);
     static NAN_GETTER(GetHeight);
     static NAN_SETTER(SetWidth);
@@ -64,10 +76,24 @@ class Canvas: public Nan::ObjectWrap {
     static NAN_METHOD(StreamPNGSync);
     static NAN_METHOD(StreamPDFSync);
     static NAN_METHOD(StreamJPEGSync);
+    static NAN_METHOD(Release);
+    static NAN_METHOD(Dispose);
+    static NAN_METHOD(Flush);
+    static NAN_METHOD(Clone);
+    static NAN_METHOD(Transfer);
+    static NAN_METHOD(GetDirtyRegions);
+    static NAN_METHOD(ClearDirty);
+    static NAN_METHOD(SurfacePoolStats);
+    static NAN_METHOD(SetSurfacePoolLimit);
+    static NAN_METHOD(Diff);
     static Local<Value> Error(cairo_status_t status);
 #if NODE_VERSION_AT_LEAST(0, 6, 0)
     static void ToBufferAsync(uv_work_t *req);
     static void ToBufferAsyncAfter(uv_work_t *req);
+    static void ToJPEGBufferAsync(uv_work_t *req);
+    static void ToJPEGBufferAsyncAfter(uv_work_t *req);
+    static void DiffAsync(uv_work_t *req);
+    static void DiffAsyncAfter(uv_work_t *req);
 #else
     static
 #if NODE_VERSION_AT_LEAST(0, 5, 4)
@@ -81,17 +107,47 @@ class Canvas: public Nan::ObjectWrap {
 
     inline bool isPDF(){ return CANVAS_TYPE_PDF == type; }
     inline bool isSVG(){ return CANVAS_TYPE_SVG == type; }
-    inline cairo_surface_t *surface(){ return _surface; }
+    inline bool isRecording(){ return CANVAS_TYPE_RECORDING == type; }
+    inline bool isExternal(){ return !_buffer.IsEmpty(); }
+    bool isDetached();
+    inline cairo_surface_t *surface(){ if (!_surface) allocate(); return _surface; }
     inline void *closure(){ return _closure; }
-    inline uint8_t *data(){ return cairo_image_surface_get_data(_surface); }
-    inline int stride(){ return cairo_image_surface_get_stride(_surface); }
-    Canvas(int width, int height, canvas_type_t type);
-    void resurface(Local<Object> canvas);
+    inline uint8_t *data(){ return cairo_image_surface_get_data(surface()); }
+    inline int stride(){ return cairo_image_surface_get_stride(surface()); }
+    Canvas(int width, int height, canvas_type_t type
+      , cairo_format_t format = CAIRO_FORMAT_ARGB32
+      , Local<Object> buffer = Local<Object>()
+      , int stride = 0);
+    void resurface(Local<Object> canvas, bool dispose = false);
+    void trackMemory();
+    void adopt(cairo_surface_t *surface);
+    void damage(int x1, int y1, int x2, int y2);
+    void damageAll();
+    cairo_surface_t *imageSurface(bool rgb = false);
+    cairo_surface_t *rebase();
+    inline bool isRasterized(){ return _raster && !_pending; }
+    inline void invalidateRaster(){ _pending = true; }
 
   private:
     ~Canvas();
+    void allocate();
+    cairo_surface_t *rasterize();
     cairo_surface_t *_surface;
+    // Tiled canvases: the pixels as of the last read, the pixels
+    // the recording started from, and whether it was drawn to since
+    cairo_surface_t *_raster;
+    cairo_surface_t *_base;
+    bool _pending;
     void *_closure;
+    void *_snapshot;
+    intptr_t _memory;
+#if CAIRO_VERSION_MINOR >= 10
+    cairo_region_t *_dirty;
+#endif
+    Nan::Persistent<Object> _buffer;
+#if NODE_MODULE_VERSION >= 83
+    std::shared_ptr<BackingStore> _store;
+#endif
 };
 
 #endif
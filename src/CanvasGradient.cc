@@ -9,7 +9,7 @@
 #include "Canvas.h"
 #include "CanvasGradient.h"
 
-Nan::Persistent<FunctionTemplate> Gradient::constructor;
+IsolatePersistent<FunctionTemplate> Gradient::constructor;
 
 /*
  * Initialize CanvasGradient.
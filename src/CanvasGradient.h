@@ -12,7 +12,7 @@
 
 class Gradient: public Nan::ObjectWrap {
   public:
-    static Nan::Persistent<FunctionTemplate> constructor;
+    static IsolatePersistent<FunctionTemplate> constructor;
     static void Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target);
     static NAN_METHOD(New);
     static NAN_METHOD(AddColorStop);
@@ -9,7 +9,7 @@
 #include "Image.h"
 #include "CanvasPattern.h"
 
-Nan::Persistent<FunctionTemplate> Pattern::constructor;
+IsolatePersistent<FunctionTemplate> Pattern::constructor;
 
 /*
  * Initialize CanvasPattern.
@@ -46,7 +46,7 @@ NAN_METHOD(Pattern::New) {
   Local<Object> obj = info[0]->ToObject();
 
   // Image
-  if (Nan::New(Image::constructor)->HasInstance(obj)) {
+  if (Image::constructor.Get()->HasInstance(obj)) {
     Image *img = Nan::ObjectWrap::Unwrap<Image>(obj);
     if (!img->isComplete()) {
       return Nan::ThrowError("Image given has not completed loading");
@@ -54,8 +54,9 @@ NAN_METHOD(Pattern::New) {
     surface = img->surface();
 
   // Canvas
-  } else if (Nan::New(Canvas::constructor)->HasInstance(obj)) {
+  } else if (Canvas::constructor.Get()->HasInstance(obj)) {
     Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(obj);
+    CANVAS_CHECK_ATTACHED(canvas);
     surface = canvas->surface();
 
   // Invalid
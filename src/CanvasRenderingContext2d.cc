@@ -8,21 +8,32 @@
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <limits>
 #include <vector>
 #include <algorithm>
+#include <list>
+#include <map>
+#include <string>
 #include "Canvas.h"
-#include "Point.h"
 #include "Image.h"
 #include "ImageData.h"
 #include "CanvasRenderingContext2d.h"
 #include "CanvasGradient.h"
 #include "CanvasPattern.h"
+#include "Path2D.h"
+#include "blur.h"
+#include "ShadowCache.h"
+#include "tiles.h"
 
 #ifdef HAVE_FREETYPE
 #include "FontFace.h"
 #endif
 
+#if HAVE_PANGO
+#include "TextLayoutCache.h"
+#endif
+
 // Windows doesn't support the C99 names for these
 #ifdef _MSC_VER
 #define isnan(x) _isnan(x)
@@ -34,7 +45,7 @@
 #define isinf(x) std::isinf(x)
 #endif
 
-Nan::Persistent<FunctionTemplate> Context2d::constructor;
+IsolatePersistent<FunctionTemplate> Context2d::constructor;
 
 /*
  * Rectangle arg assertions.
@@ -50,6 +61,18 @@ Nan::Persistent<FunctionTemplate> Context2d::constructor;
   double width = info[2]->NumberValue(); \
   double height = info[3]->NumberValue();
 
+/*
+ * Return the Path2D wrapped by `value`, or NULL.
+ */
+
+static Path2D *
+unwrapPath(Local<Value> value) {
+  if (!value->IsObject()) return NULL;
+  Local<Object> obj = value->ToObject();
+  if (!Path2D::constructor.Get()->HasInstance(obj)) return NULL;
+  return Nan::ObjectWrap::Unwrap<Path2D>(obj);
+}
+
 /*
  * Text baselines.
  */
@@ -66,23 +89,145 @@ enum {
 #if HAVE_PANGO
 
 /*
- * State helper function
+ * Interned font family names, keyed by name. Like the caches below
+ * they are kept per thread, since worker threads render too.
  */
 
-void state_assign_fontFamily(canvas_state_t *state, const char *str) {
-  free(state->fontFamily);
-  state->fontFamily = strndup(str, 100);
+static thread_local map<string, canvas_font_family_t *> font_families;
+
+/*
+ * Return the retained family for `name`, creating it when needed.
+ */
+
+canvas_font_family_t *
+font_family_intern(const char *name) {
+  string key(name, strnlen(name, 100));
+  map<string, canvas_font_family_t *>::iterator it = font_families.find(key);
+  if (it != font_families.end()) {
+    it->second->refs++;
+    return it->second;
+  }
+
+  canvas_font_family_t *family = (canvas_font_family_t *) malloc(sizeof(canvas_font_family_t));
+  family->refs = 1;
+  family->name = strdup(key.c_str());
+  font_families[key] = family;
+  return family;
+}
+
+void
+font_family_retain(canvas_font_family_t *family) {
+  if (family) family->refs++;
+}
+
+void
+font_family_release(canvas_font_family_t *family) {
+  if (!family || --family->refs) return;
+  font_families.erase(family->name);
+  free(family->name);
+  free(family);
+}
+
+void
+font_family_clear() {
+  map<string, canvas_font_family_t *>::iterator it = font_families.begin();
+  for (; it != font_families.end(); ++it) {
+    free(it->second->name);
+    free(it->second);
+  }
+  font_families.clear();
+}
+
+/*
+ * Font description cache key. The family is interned,
+ * so it's compared by identity.
+ */
+
+typedef struct font_description_key {
+  canvas_font_family_t *family;
+  double size;
+  PangoStyle style;
+  PangoWeight weight;
+
+  bool operator<(const font_description_key &other) const {
+    if (family != other.family) return family < other.family;
+    if (size != other.size) return size < other.size;
+    if (style != other.style) return style < other.style;
+    return weight < other.weight;
+  }
+} font_description_key_t;
+
+typedef list<pair<font_description_key_t, PangoFontDescription *> > font_description_lru_t;
+
+/*
+ * Bounded LRU of font descriptions shared by the contexts of a thread.
+ * Entries retain their family so the key stays valid until evicted.
+ */
+
+#define FONT_DESCRIPTION_CACHE_MAX 256
+
+static thread_local font_description_lru_t font_description_lru;
+static thread_local map<font_description_key_t, font_description_lru_t::iterator> font_descriptions;
+static thread_local uint32_t font_description_hits = 0;
+static thread_local uint32_t font_description_misses = 0;
+static thread_local uint32_t font_description_skips = 0;
+
+/*
+ * Return the cached description for `key`, creating it on a miss.
+ */
+
+static PangoFontDescription *
+font_description_lookup(const font_description_key_t &key) {
+  map<font_description_key_t, font_description_lru_t::iterator>::iterator it = font_descriptions.find(key);
+  if (it != font_descriptions.end()) {
+    font_description_hits++;
+    font_description_lru.splice(font_description_lru.begin(), font_description_lru, it->second);
+    return it->second->second;
+  }
+
+  font_description_misses++;
+  PangoFontDescription *fd = pango_font_description_new();
+  pango_font_description_set_family(fd, key.family->name);
+  pango_font_description_set_absolute_size(fd, key.size * PANGO_SCALE);
+  pango_font_description_set_style(fd, key.style);
+  pango_font_description_set_weight(fd, key.weight);
+
+  font_family_retain(key.family);
+  font_description_lru.push_front(make_pair(key, fd));
+  font_descriptions[key] = font_description_lru.begin();
+
+  if (font_description_lru.size() > FONT_DESCRIPTION_CACHE_MAX) {
+    font_description_lru_t::iterator last = --font_description_lru.end();
+    font_descriptions.erase(last->first);
+    pango_font_description_free(last->second);
+    font_family_release(last->first.family);
+    font_description_lru.erase(last);
+  }
+
+  return fd;
 }
 
+void
+font_description_cache_clear() {
+  font_description_lru_t::iterator it = font_description_lru.begin();
+  for (; it != font_description_lru.end(); ++it) {
+    pango_font_description_free(it->second);
+    font_family_release(it->first.family);
+  }
+  font_description_lru.clear();
+  font_descriptions.clear();
+}
 
 /*
- * Simple helper macro for a rather verbose function call.
+ * State helper function
  */
 
-#define PANGO_LAYOUT_GET_METRICS(LAYOUT) pango_context_get_metrics( \
-   pango_layout_get_context(LAYOUT), \
-   pango_layout_get_font_description(LAYOUT), \
-   pango_context_get_language(pango_layout_get_context(LAYOUT)))
+void state_assign_fontFamily(canvas_state_t *state, const char *str) {
+  canvas_font_family_t *family = font_family_intern(str);
+  font_family_release(state->fontFamily);
+  state->fontFamily = family;
+}
+
 
 #endif
 
@@ -124,8 +269,13 @@ Context2d::Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target) {
   Nan::SetPrototypeMethod(ctor, "clearRect", ClearRect);
   Nan::SetPrototypeMethod(ctor, "rect", Rect);
   Nan::SetPrototypeMethod(ctor, "measureText", MeasureText);
+  Nan::SetPrototypeMethod(ctor, "fillTextBatch", FillTextBatch);
+  Nan::SetPrototypeMethod(ctor, "measureTextBatch", MeasureTextBatch);
   Nan::SetPrototypeMethod(ctor, "moveTo", MoveTo);
   Nan::SetPrototypeMethod(ctor, "lineTo", LineTo);
+  Nan::SetPrototypeMethod(ctor, "polyline", Polyline);
+  Nan::SetPrototypeMethod(ctor, "polygons", Polygons);
+  Nan::SetPrototypeMethod(ctor, "_execute", Execute);
   Nan::SetPrototypeMethod(ctor, "bezierCurveTo", BezierCurveTo);
   Nan::SetPrototypeMethod(ctor, "quadraticCurveTo", QuadraticCurveTo);
   Nan::SetPrototypeMethod(ctor, "beginPath", BeginPath);
@@ -144,7 +294,12 @@ Context2d::Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target) {
   Nan::SetPrototypeMethod(ctor, "_setStrokePattern", SetStrokePattern);
   Nan::SetPrototypeMethod(ctor, "_setTextBaseline", SetTextBaseline);
   Nan::SetPrototypeMethod(ctor, "_setTextAlignment", SetTextAlignment);
+  Nan::SetMethod(ctor, "fontCacheStats", FontCacheStats);
+  Nan::SetMethod(ctor, "textLayoutCacheStats", TextLayoutCacheStats);
+  Nan::SetMethod(ctor, "shadowCacheStats", ShadowCacheStats);
+  Nan::SetMethod(ctor, "setShadowCacheLimit", SetShadowCacheLimit);
   Nan::SetAccessor(proto, Nan::New("patternQuality").ToLocalChecked(), GetPatternQuality, SetPatternQuality);
+  Nan::SetAccessor(proto, Nan::New("imageSmoothingQuality").ToLocalChecked(), GetImageSmoothingQuality, SetImageSmoothingQuality);
   Nan::SetAccessor(proto, Nan::New("globalCompositeOperation").ToLocalChecked(), GetGlobalCompositeOperation, SetGlobalCompositeOperation);
   Nan::SetAccessor(proto, Nan::New("globalAlpha").ToLocalChecked(), GetGlobalAlpha, SetGlobalAlpha);
   Nan::SetAccessor(proto, Nan::New("shadowColor").ToLocalChecked(), GetShadowColor, SetShadowColor);
@@ -165,17 +320,21 @@ Context2d::Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target) {
 }
 
 /*
- * Create a cairo context.
+ * Create a context. The cairo context is created on first use, so
+ * that getContext() doesn't allocate the pixels of image canvases.
  */
 
 Context2d::Context2d(Canvas *canvas) {
   _canvas = canvas;
-  _context = cairo_create(canvas->surface());
+  _context = NULL;
+  _measure = NULL;
 #if HAVE_PANGO
-  _layout = pango_cairo_create_layout(_context);
+  _layout = pango_cairo_create_layout(measureContext());
+  _layoutFontFamily = NULL;
 #endif
-  cairo_set_line_width(_context, 1);
-  state = states[stateno = 0] = (canvas_state_t *) malloc(sizeof(canvas_state_t));
+  _path = NULL;
+  states.resize(1);
+  state = &states[stateno = 0];
   state->shadowBlur = 0;
   state->shadowOffsetX = state->shadowOffsetY = 0;
   state->globalAlpha = 1;
@@ -189,7 +348,9 @@ Context2d::Context2d(Canvas *canvas) {
   state->stroke = transparent;
   state->shadow = transparent_black;
   state->patternQuality = CAIRO_FILTER_GOOD;
+  state->imageSmoothingQuality = SMOOTHING_QUALITY_LOW;
   state->textDrawingMode = TEXT_DRAW_PATHS;
+  state->hasClip = false;
 #if HAVE_PANGO
   state->fontWeight = PANGO_WEIGHT_NORMAL;
   state->fontStyle = PANGO_STYLE_NORMAL;
@@ -205,16 +366,140 @@ Context2d::Context2d(Canvas *canvas) {
  */
 
 Context2d::~Context2d() {
-  while(stateno >= 0) {
 #if HAVE_PANGO
-    free(states[stateno]->fontFamily);
+  while(stateno >= 0)
+    font_family_release(states[stateno--].fontFamily);
 #endif
-    free(states[stateno--]);
-  }
 #if HAVE_PANGO
+  font_family_release(_layoutFontFamily);
   g_object_unref(_layout);
 #endif
   cairo_destroy(_context);
+  cairo_destroy(_measure);
+}
+
+/*
+ * Create the cairo context of the canvas surface.
+ */
+
+void
+Context2d::createContext() {
+  _context = cairo_create(_canvas->surface());
+  cairo_set_line_width(_context, 1);
+  cairo_destroy(_measure);
+  _measure = NULL;
+}
+
+/*
+ * Tiled canvases rasterize their recording when read and then record on
+ * top of those pixels, so that the next read only replays what was drawn
+ * since. The first use of the context after a read starts that recording,
+ * unless a save() or a clip the new cairo context can't take over is in
+ * effect, in which case drawing goes on in the current recording.
+ */
+
+void
+Context2d::retarget() {
+  bool rasterized = _canvas->isRasterized();
+  _canvas->invalidateRaster();
+  if (_context && !rasterized
+    && cairo_get_target(_context) == _canvas->surface()) return;
+
+  // The clip in device space
+  cairo_rectangle_list_t *clip = NULL;
+  if (_context && state->hasClip) {
+    cairo_save(_context);
+    cairo_identity_matrix(_context);
+    clip = cairo_copy_clip_rectangle_list(_context);
+    cairo_restore(_context);
+  }
+
+  cairo_surface_t *base = NULL;
+  if (rasterized && !(_context && stateno) && !(clip && clip->status))
+    base = _canvas->rebase();
+
+  if (!_context) createContext();
+  else if (cairo_get_target(_context) != _canvas->surface()) moveContext(clip);
+
+  if (clip) cairo_rectangle_list_destroy(clip);
+  cairo_surface_destroy(base);
+}
+
+/*
+ * Create the cairo context again on the canvas surface, carrying over
+ * the transform, the path, the given device space `clip` and the
+ * stroke and fill settings of the current one.
+ */
+
+void
+Context2d::moveContext(cairo_rectangle_list_t *clip) {
+  cairo_t *prev = _context;
+  createContext();
+
+  cairo_matrix_t matrix;
+  cairo_get_matrix(prev, &matrix);
+  cairo_identity_matrix(prev);
+
+  if (clip && !clip->status) {
+    for (int i = 0; i < clip->num_rectangles; ++i) {
+      cairo_rectangle_t *rect = &clip->rectangles[i];
+      cairo_rectangle(_context, rect->x, rect->y, rect->width, rect->height);
+    }
+    cairo_clip(_context);
+  }
+
+  cairo_path_t *path = cairo_copy_path(prev);
+  cairo_append_path(_context, path);
+  cairo_path_destroy(path);
+  cairo_set_matrix(_context, &matrix);
+
+  cairo_set_operator(_context, cairo_get_operator(prev));
+  cairo_set_antialias(_context, cairo_get_antialias(prev));
+  cairo_set_fill_rule(_context, cairo_get_fill_rule(prev));
+  cairo_set_tolerance(_context, cairo_get_tolerance(prev));
+  cairo_set_line_width(_context, cairo_get_line_width(prev));
+  cairo_set_line_cap(_context, cairo_get_line_cap(prev));
+  cairo_set_line_join(_context, cairo_get_line_join(prev));
+  cairo_set_miter_limit(_context, cairo_get_miter_limit(prev));
+  cairo_set_source(_context, cairo_get_source(prev));
+  cairo_set_font_face(_context, cairo_get_font_face(prev));
+  cairo_get_font_matrix(prev, &matrix);
+  cairo_set_font_matrix(_context, &matrix);
+
+  int count = cairo_get_dash_count(prev);
+  std::vector<double> dashes(count);
+  double offset;
+  cairo_get_dash(prev, dashes.data(), &offset);
+  cairo_set_dash(_context, dashes.data(), count, offset);
+
+  cairo_destroy(prev);
+}
+
+/*
+ * Drop the cairo context, which is created again on next use.
+ */
+
+void
+Context2d::resetContext() {
+  cairo_destroy(_context);
+  _context = NULL;
+}
+
+/*
+ * The cairo context to lay text out with. Image canvases that haven't
+ * used their context yet measure on a 1x1 surface, which lays text out
+ * like a fresh context, so measuring alone doesn't allocate the pixels.
+ */
+
+cairo_t *
+Context2d::measureContext() {
+  if (_context || CANVAS_TYPE_IMAGE != _canvas->type) return context();
+  if (!_measure) {
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+    _measure = cairo_create(surface);
+    cairo_surface_destroy(surface);
+  }
+  return _measure;
 }
 
 /*
@@ -223,7 +508,7 @@ Context2d::~Context2d() {
 
 void
 Context2d::save() {
-  cairo_save(_context);
+  cairo_save(context());
   saveState();
 }
 
@@ -233,23 +518,28 @@ Context2d::save() {
 
 void
 Context2d::restore() {
-  cairo_restore(_context);
+  cairo_restore(context());
   restoreState();
 }
 
 /*
- * Save the current state.
+ * Save the current state. Slots are kept around after restore()
+ * so balanced save() / restore() pairs don't touch the heap.
  */
 
 void
 Context2d::saveState() {
-  if (stateno == CANVAS_MAX_STATES) return;
-  states[++stateno] = (canvas_state_t *) malloc(sizeof(canvas_state_t));
-  memcpy(states[stateno], state, sizeof(canvas_state_t));
+  if (++stateno == (int) states.size()) {
+    // copy first, growing may move *state
+    canvas_state_t copy = *state;
+    states.push_back(copy);
+  } else {
+    states[stateno] = *state;
+  }
+  state = &states[stateno];
 #if HAVE_PANGO
-  states[stateno]->fontFamily = strndup(state->fontFamily, 100);
+  font_family_retain(state->fontFamily);
 #endif
-  state = states[stateno];
 }
 
 /*
@@ -259,37 +549,43 @@ Context2d::saveState() {
 void
 Context2d::restoreState() {
   if (0 == stateno) return;
-  // Olaf (2011-02-21): Free old state data
 #if HAVE_PANGO
-  free(states[stateno]->fontFamily);
+  font_family_release(state->fontFamily);
 #endif
-  free(states[stateno]);
-  states[stateno] = NULL;
-  state = states[--stateno];
+  state = &states[--stateno];
 #if HAVE_PANGO
   setFontFromState();
 #endif
 }
 
 /*
- * Save flat path.
+ * Save the path and start a new one. Nothing is copied when the
+ * path is empty, which is by far the common case around fillText()
+ * and fillRect().
  */
 
 void
 Context2d::savePath() {
-  _path = cairo_copy_path_flat(_context);
-  cairo_new_path(_context);
+  if (cairo_has_current_point(context())) {
+    _path = cairo_copy_path(context());
+    cairo_new_path(context());
+  } else {
+    _path = NULL;
+  }
 }
 
 /*
- * Restore flat path.
+ * Restore the path saved by savePath().
  */
 
 void
 Context2d::restorePath() {
-  cairo_new_path(_context);
-  cairo_append_path(_context, _path);
-  cairo_path_destroy(_path);
+  cairo_new_path(context());
+  if (_path) {
+    cairo_append_path(context(), _path);
+    cairo_path_destroy(_path);
+    _path = NULL;
+  }
 }
 
 /*
@@ -305,30 +601,32 @@ Context2d::setFillRule(v8::Local<v8::Value> value) {
       rule = CAIRO_FILL_RULE_EVEN_ODD;
     }
   }
-  cairo_set_fill_rule(_context, rule);
+  cairo_set_fill_rule(context(), rule);
 }
 
 void
 Context2d::fill(bool preserve) {
   if (state->fillPattern) {
-    cairo_set_source(_context, state->fillPattern);
-    cairo_pattern_set_extend(cairo_get_source(_context), CAIRO_EXTEND_REPEAT);
+    _canvas->drawsSurfaces = true;
+    cairo_set_source(context(), state->fillPattern);
+    cairo_pattern_set_extend(cairo_get_source(context()), CAIRO_EXTEND_REPEAT);
     // TODO repeat/repeat-x/repeat-y
   } else if (state->fillGradient) {
     cairo_pattern_set_filter(state->fillGradient, state->patternQuality);
-    cairo_set_source(_context, state->fillGradient);
+    cairo_set_source(context(), state->fillGradient);
   } else {
     setSourceRGBA(state->fill);
   }
 
+  damagePath(false);
   if (preserve) {
     hasShadow()
       ? shadow(cairo_fill_preserve)
-      : cairo_fill_preserve(_context);
+      : cairo_fill_preserve(context());
   } else {
     hasShadow()
       ? shadow(cairo_fill)
-      : cairo_fill(_context);
+      : cairo_fill(context());
   }
 }
 
@@ -339,23 +637,25 @@ Context2d::fill(bool preserve) {
 void
 Context2d::stroke(bool preserve) {
   if (state->strokePattern) {
-    cairo_set_source(_context, state->strokePattern);
-    cairo_pattern_set_extend(cairo_get_source(_context), CAIRO_EXTEND_REPEAT);
+    _canvas->drawsSurfaces = true;
+    cairo_set_source(context(), state->strokePattern);
+    cairo_pattern_set_extend(cairo_get_source(context()), CAIRO_EXTEND_REPEAT);
   } else if (state->strokeGradient) {
     cairo_pattern_set_filter(state->strokeGradient, state->patternQuality);
-    cairo_set_source(_context, state->strokeGradient);
+    cairo_set_source(context(), state->strokeGradient);
   } else {
     setSourceRGBA(state->stroke);
   }
 
+  damagePath(true);
   if (preserve) {
     hasShadow()
       ? shadow(cairo_stroke_preserve)
-      : cairo_stroke_preserve(_context);
+      : cairo_stroke_preserve(context());
   } else {
     hasShadow()
       ? shadow(cairo_stroke)
-      : cairo_stroke(_context);
+      : cairo_stroke(context());
   }
 }
 
@@ -365,81 +665,112 @@ Context2d::stroke(bool preserve) {
 
 void
 Context2d::shadow(void (fn)(cairo_t *cr)) {
-  cairo_path_t *path = cairo_copy_path_flat(_context);
-  cairo_save(_context);
+  cairo_path_t *path = cairo_copy_path(context());
+  cairo_save(context());
 
   // shadowOffset is unaffected by current transform
   cairo_matrix_t path_matrix;
-  cairo_get_matrix(_context, &path_matrix);
-  cairo_identity_matrix(_context);
+  cairo_get_matrix(context(), &path_matrix);
+  cairo_identity_matrix(context());
 
   // Apply shadow
-  cairo_push_group(_context);
+  cairo_push_group(context());
 
   // No need to invoke blur if shadowBlur is 0
   if (state->shadowBlur) {
     // find out extent of path
+    bool filling = fn == cairo_fill || fn == cairo_fill_preserve;
     double x1, y1, x2, y2;
-    if (fn == cairo_fill || fn == cairo_fill_preserve) {
-      cairo_fill_extents(_context, &x1, &y1, &x2, &y2);
+    if (filling) {
+      cairo_fill_extents(context(), &x1, &y1, &x2, &y2);
     } else {
-      cairo_stroke_extents(_context, &x1, &y1, &x2, &y2);
+      cairo_stroke_extents(context(), &x1, &y1, &x2, &y2);
     }
 
-    // create new image surface that size + padding for blurring
-    double dx = x2-x1, dy = y2-y1;
-    cairo_user_to_device_distance(_context, &dx, &dy);
+    // the mask origin is kept on the pixel grid
     int pad = state->shadowBlur * 2;
-    cairo_surface_t *shadow_surface = cairo_image_surface_create(
-      CAIRO_FORMAT_ARGB32,
-      dx + 2 * pad,
-      dy + 2 * pad);
-    cairo_t *shadow_context = cairo_create(shadow_surface);
-
-    // transform path to the right place
-    cairo_translate(shadow_context, pad-x1, pad-y1);
-    cairo_transform(shadow_context, &path_matrix);
-
-    // draw the path and blur
-    cairo_set_line_width(shadow_context, cairo_get_line_width(_context));
-    cairo_new_path(shadow_context);
-    cairo_append_path(shadow_context, path);
-    setSourceRGBA(shadow_context, state->shadow);
-    fn(shadow_context);
-    blur(shadow_surface, state->shadowBlur);
+    double ox = floor(x1), oy = floor(y1);
+
+    // The mask only depends on the device space path relative to its
+    // origin and the state below, so repeated shapes hit the cache
+    shadow_key_t key;
+    key.source = NULL;
+    cairo_path_t *device_path = cairo_copy_path(context());
+    bool cacheable = shadow_key_append_path(&key, device_path, ox, oy);
+    cairo_path_destroy(device_path);
+
+    if (cacheable) {
+      key.data.push_back(filling);
+      key.data.push_back(cairo_get_fill_rule(context()));
+      if (!filling) {
+        key.data.push_back(cairo_get_line_width(context()));
+        key.data.push_back(path_matrix.xx);
+        key.data.push_back(path_matrix.yx);
+        key.data.push_back(path_matrix.xy);
+        key.data.push_back(path_matrix.yy);
+      }
+      key.data.push_back(state->shadowBlur);
+    }
+
+    cairo_surface_t *shadow_surface = cacheable ? shadow_cache_lookup(key) : NULL;
+
+    if (!shadow_surface) {
+      // The shadow is a single color, so only its alpha is drawn
+      // and blurred, the color is applied when compositing
+      shadow_surface = cairo_image_surface_create(
+        CAIRO_FORMAT_A8,
+        ceil(x2) - ox + 2 * pad,
+        ceil(y2) - oy + 2 * pad);
+      cairo_t *shadow_context = cairo_create(shadow_surface);
+
+      // transform path to the right place
+      cairo_translate(shadow_context, pad - ox, pad - oy);
+      cairo_transform(shadow_context, &path_matrix);
+
+      // draw the path and blur
+      cairo_set_line_width(shadow_context, cairo_get_line_width(context()));
+      cairo_set_fill_rule(shadow_context, cairo_get_fill_rule(context()));
+      cairo_new_path(shadow_context);
+      cairo_append_path(shadow_context, path);
+      fn(shadow_context);
+      cairo_destroy(shadow_context);
+      blur(shadow_surface, state->shadowBlur);
+
+      if (cacheable) shadow_cache_insert(key, shadow_surface);
+    }
 
     // paint to original context
-    cairo_set_source_surface(_context, shadow_surface,
-      x1 - pad + state->shadowOffsetX + 1,
-      y1 - pad + state->shadowOffsetY + 1);
-    cairo_paint(_context);
-    cairo_destroy(shadow_context);
+    _canvas->drawsSurfaces = true;
+    setSourceRGBA(state->shadow);
+    cairo_mask_surface(context(), shadow_surface,
+      ox - pad + state->shadowOffsetX + 1,
+      oy - pad + state->shadowOffsetY + 1);
     cairo_surface_destroy(shadow_surface);
   } else {
     // Offset first, then apply path's transform
     cairo_translate(
-        _context
+        context()
       , state->shadowOffsetX
       , state->shadowOffsetY);
-    cairo_transform(_context, &path_matrix);
+    cairo_transform(context(), &path_matrix);
 
     // Apply shadow
-    cairo_new_path(_context);
-    cairo_append_path(_context, path);
+    cairo_new_path(context());
+    cairo_append_path(context(), path);
     setSourceRGBA(state->shadow);
 
-    fn(_context);
+    fn(context());
   }
 
   // Paint the shadow
-  cairo_pop_group_to_source(_context);
-  cairo_paint(_context);
+  cairo_pop_group_to_source(context());
+  cairo_paint(context());
 
   // Restore state
-  cairo_restore(_context);
-  cairo_new_path(_context);
-  cairo_append_path(_context, path);
-  fn(_context);
+  cairo_restore(context());
+  cairo_new_path(context());
+  cairo_append_path(context(), path);
+  fn(context());
 
   cairo_path_destroy(path);
 }
@@ -450,7 +781,7 @@ Context2d::shadow(void (fn)(cairo_t *cr)) {
 
 void
 Context2d::setSourceRGBA(rgba_t color) {
-  setSourceRGBA(_context, color);
+  setSourceRGBA(context(), color);
 }
 
 /*
@@ -483,64 +814,88 @@ Context2d::hasShadow() {
 
 void
 Context2d::blur(cairo_surface_t *surface, int radius) {
-  // Steve Hanov, 2009
-  // Released into the public domain.
-  radius = radius * 0.57735f + 0.5f;
-  // get width, height
-  int width = cairo_image_surface_get_width( surface );
-  int height = cairo_image_surface_get_height( surface );
-  unsigned* precalc =
-      (unsigned*)malloc(width*height*sizeof(unsigned));
-  cairo_surface_flush( surface );
-  unsigned char* src = cairo_image_surface_get_data( surface );
-  double mul=1.f/((radius*2)*(radius*2));
-  int channel;
-
-  // The number of times to perform the averaging. According to wikipedia,
-  // three iterations is good enough to pass for a gaussian.
-  const int MAX_ITERATIONS = 3;
-  int iteration;
-
-  for ( iteration = 0; iteration < MAX_ITERATIONS; iteration++ ) {
-      for( channel = 0; channel < 4; channel++ ) {
-          int x,y;
-
-          // precomputation step.
-          unsigned char* pix = src;
-          unsigned* pre = precalc;
-
-          pix += channel;
-          for (y=0;y<height;y++) {
-              for (x=0;x<width;x++) {
-                  int tot=pix[0];
-                  if (x>0) tot+=pre[-1];
-                  if (y>0) tot+=pre[-width];
-                  if (x>0 && y>0) tot-=pre[-width-1];
-                  *pre++=tot;
-                  pix += 4;
-              }
-          }
-
-          // blur step.
-          pix = src + (int)radius * width * 4 + (int)radius * 4 + channel;
-          for (y=radius;y<height-radius;y++) {
-              for (x=radius;x<width-radius;x++) {
-                  int l = x < radius ? 0 : x - radius;
-                  int t = y < radius ? 0 : y - radius;
-                  int r = x + radius >= width ? width - 1 : x + radius;
-                  int b = y + radius >= height ? height - 1 : y + radius;
-                  int tot = precalc[r+b*width] + precalc[l+t*width] -
-                      precalc[l+b*width] - precalc[r+t*width];
-                  *pix=(unsigned char)(tot*mul);
-                  pix += 4;
-              }
-              pix += (int)radius * 2 * 4;
-          }
-      }
+  canvas_blur(surface, radius);
+}
+
+/*
+ * Device space bounds of the user space box x1, y1, x2, y2.
+ */
+
+static void
+user_to_device_box(cairo_t *ctx, double *x1, double *y1, double *x2, double *y2) {
+  double xs[4] = { *x1, *x2, *x2, *x1 }
+    , ys[4] = { *y1, *y1, *y2, *y2 };
+  for (int i = 0; i < 4; ++i) {
+    cairo_user_to_device(ctx, &xs[i], &ys[i]);
+    if (!i || xs[i] < *x1) *x1 = xs[i];
+    if (!i || ys[i] < *y1) *y1 = ys[i];
   }
+  for (int i = 0; i < 4; ++i) {
+    if (!i || xs[i] > *x2) *x2 = xs[i];
+    if (!i || ys[i] > *y2) *y2 = ys[i];
+  }
+}
 
-  cairo_surface_mark_dirty(surface);
-  free(precalc);
+/*
+ * Mark the user space box x1, y1, x2, y2 as changed on the canvas,
+ * grown by the shadow and limited to the clip. Operators that also
+ * change pixels outside of what is drawn mark the whole clip.
+ */
+
+void
+Context2d::damage(double x1, double y1, double x2, double y2) {
+  double cx1, cy1, cx2, cy2;
+  cairo_clip_extents(context(), &cx1, &cy1, &cx2, &cy2);
+
+  switch (cairo_get_operator(context())) {
+    case CAIRO_OPERATOR_IN:
+    case CAIRO_OPERATOR_OUT:
+    case CAIRO_OPERATOR_DEST_IN:
+    case CAIRO_OPERATOR_DEST_ATOP:
+      x1 = cx1, y1 = cy1, x2 = cx2, y2 = cy2;
+      break;
+    default:
+      if (x1 == x2 || y1 == y2) return;
+  }
+
+  user_to_device_box(context(), &x1, &y1, &x2, &y2);
+  user_to_device_box(context(), &cx1, &cy1, &cx2, &cy2);
+
+  // The shadow is offset in device space, with room for the blur
+  if (hasShadow()) {
+    double pad = state->shadowBlur * 2 + 2;
+    x1 = (std::min)(x1, x1 + state->shadowOffsetX - pad);
+    y1 = (std::min)(y1, y1 + state->shadowOffsetY - pad);
+    x2 = (std::max)(x2, x2 + state->shadowOffsetX + pad);
+    y2 = (std::max)(y2, y2 + state->shadowOffsetY + pad);
+  }
+
+  x1 = (std::max)(x1, (std::max)(cx1, 0.0));
+  y1 = (std::max)(y1, (std::max)(cy1, 0.0));
+  x2 = (std::min)(x2, (std::min)(cx2, (double) _canvas->width));
+  y2 = (std::min)(y2, (std::min)(cy2, (double) _canvas->height));
+  if (x1 >= x2 || y1 >= y2) return;
+
+  _canvas->damage(floor(x1), floor(y1), ceil(x2), ceil(y2));
+}
+
+/*
+ * Mark the bounds of the current path as changed, as filled
+ * or as stroked with the current line width and joins.
+ */
+
+void
+Context2d::damagePath(bool stroking) {
+  double x1, y1, x2, y2;
+  cairo_path_extents(context(), &x1, &y1, &x2, &y2);
+  if (stroking) {
+    // miters reach at most miterLimit half widths out, square caps sqrt(2)
+    double pad = cairo_get_line_width(context()) / 2
+      * (std::max)(cairo_get_miter_limit(context()), M_SQRT2);
+    if (x1 == x2 && y1 == y2 && !cairo_has_current_point(context())) return;
+    x1 -= pad, y1 -= pad, x2 += pad, y2 += pad;
+  }
+  damage(x1, y1, x2, y2);
 }
 
 /*
@@ -553,7 +908,7 @@ NAN_METHOD(Context2d::New) {
   }
 
   Local<Object> obj = info[0]->ToObject();
-  if (!Nan::New(Canvas::constructor)->HasInstance(obj))
+  if (!Canvas::constructor.Get()->HasInstance(obj))
     return Nan::ThrowTypeError("Canvas expected");
   Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(obj);
   Context2d *context = new Context2d(canvas);
@@ -571,6 +926,7 @@ NAN_METHOD(Context2d::AddPage) {
     return Nan::ThrowError("only PDF canvases support .nextPage()");
   }
   cairo_show_page(context->context());
+  context->canvas()->trackMemory();
   return;
 }
 
@@ -586,17 +942,16 @@ NAN_METHOD(Context2d::PutImageData) {
   if (!info[0]->IsObject())
     return Nan::ThrowTypeError("ImageData expected");
   Local<Object> obj = info[0]->ToObject();
-  if (!Nan::New(ImageData::constructor)->HasInstance(obj))
+  if (!ImageData::constructor.Get()->HasInstance(obj))
     return Nan::ThrowTypeError("ImageData expected");
 
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  CANVAS_CHECK_ATTACHED(context->canvas());
   ImageData *imageData = Nan::ObjectWrap::Unwrap<ImageData>(obj);
 
+  Canvas *canvas = context->canvas();
   uint8_t *src = imageData->data();
-  uint8_t *dst = context->canvas()->data();
-
-  int srcStride = imageData->stride()
-    , dstStride = context->canvas()->stride();
+  int srcStride = imageData->stride();
 
   int sx = 0
     , sy = 0
@@ -647,9 +1002,25 @@ NAN_METHOD(Context2d::PutImageData) {
   }
 
   if (cols <= 0 || rows <= 0) return;
+  canvas->damage(dx, dy, dx + cols, dy + rows);
+
+  // Vector and recording surfaces have no pixels of their own, and
+  // other pixel formats need converting, so the data is converted
+  // into an ARGB32 patch which is painted afterwards
+  cairo_surface_t *patch = NULL;
+  uint8_t *dst;
+  int dstStride;
+
+  if (CANVAS_TYPE_IMAGE == canvas->type && CAIRO_FORMAT_ARGB32 == canvas->format) {
+    dst = canvas->data() + canvas->stride() * dy + 4 * dx;
+    dstStride = canvas->stride();
+  } else {
+    patch = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, cols, rows);
+    dst = cairo_image_surface_get_data(patch);
+    dstStride = cairo_image_surface_get_stride(patch);
+  }
 
   src += sy * srcStride + sx * 4;
-  dst += dstStride * dy + 4 * dx;
   for (int y = 0; y < rows; ++y) {
     uint8_t *dstRow = dst;
     uint8_t *srcRow = src;
@@ -685,8 +1056,27 @@ NAN_METHOD(Context2d::PutImageData) {
     src += srcStride;
   }
 
+  if (patch) {
+    cairo_t *ctx = context->context();
+    cairo_surface_mark_dirty(patch);
+    canvas->drawsSurfaces = true;
+    context->savePath();
+    cairo_save(ctx);
+    cairo_identity_matrix(ctx);
+    cairo_reset_clip(ctx);
+    cairo_set_operator(ctx, CAIRO_OPERATOR_SOURCE);
+    cairo_rectangle(ctx, dx, dy, cols, rows);
+    cairo_clip(ctx);
+    cairo_set_source_surface(ctx, patch, dx, dy);
+    cairo_paint(ctx);
+    cairo_restore(ctx);
+    context->restorePath();
+    cairo_surface_destroy(patch);
+    return;
+  }
+
   cairo_surface_mark_dirty_rectangle(
-      context->canvas()->surface()
+      canvas->surface()
     , dx
     , dy
     , cols
@@ -703,6 +1093,10 @@ NAN_METHOD(Context2d::PutImageData) {
 NAN_METHOD(Context2d::GetImageData) {
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
   Canvas *canvas = context->canvas();
+  CANVAS_CHECK_ATTACHED(canvas);
+
+  if (canvas->isPDF() || canvas->isSVG())
+    return Nan::ThrowError("getImageData() is not supported on vector canvases");
 
   int sx = info[0]->Int32Value();
   int sy = info[1]->Int32Value();
@@ -745,10 +1139,31 @@ NAN_METHOD(Context2d::GetImageData) {
 
   int size = sw * sh * 4;
 
-  int srcStride = canvas->stride();
-  int dstStride = sw * 4;
+  // Tiled canvases read their pixels as of this read. Other recordings,
+  // and canvases with other pixel formats, are painted into an ARGB32
+  // surface covering just the region
+  cairo_surface_t *region = NULL;
+  uint8_t *src;
+  int srcStride;
+
+  if (canvas->tiled) {
+    region = canvas->imageSurface();
+    cairo_surface_flush(region);
+    src = cairo_image_surface_get_data(region);
+    srcStride = cairo_image_surface_get_stride(region);
+  } else if (canvas->isRecording() || CAIRO_FORMAT_ARGB32 != canvas->format) {
+    region = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, sw, sh);
+    canvas_replay_tiles(canvas->surface(), region, sx, sy, !canvas->drawsSurfaces);
+    cairo_surface_flush(region);
+    src = cairo_image_surface_get_data(region);
+    srcStride = cairo_image_surface_get_stride(region);
+    sx = sy = 0;
+  } else {
+    src = canvas->data();
+    srcStride = canvas->stride();
+  }
 
-  uint8_t *src = canvas->data();
+  int dstStride = sw * 4;
 
 #if NODE_MAJOR_VERSION == 0 && NODE_MINOR_VERSION <= 10
   Local<Object> global = Context::GetCurrent()->Global();
@@ -793,17 +1208,131 @@ NAN_METHOD(Context2d::GetImageData) {
     dst += dstStride;
   }
 
+  if (region) cairo_surface_destroy(region);
+
   const int argc = 3;
   Local<Int32> swHandle = Nan::New(sw);
   Local<Int32> shHandle = Nan::New(sh);
   Local<Value> argv[argc] = { clampedArray, swHandle, shHandle };
 
-  Local<FunctionTemplate> cons = Nan::New(ImageData::constructor);
+  Local<FunctionTemplate> cons = ImageData::constructor.Get();
   Local<Object> instance = cons->GetFunction()->NewInstance(argc, argv);
 
   info.GetReturnValue().Set(instance);
 }
 
+/*
+ * Composite a row of premultiplied ARGB32 pixels over `dst`.
+ * Opaque sources, including RGB24, are copied.
+ */
+
+static inline void
+blit_row(uint32_t *dst, const uint32_t *src, int n, bool opaque) {
+  if (opaque) {
+    for (int i = 0; i < n; ++i) dst[i] = src[i] | 0xff000000;
+    return;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    uint32_t s = src[i], a = s >> 24;
+    if (255 == a) {
+      dst[i] = s;
+    } else if (a) {
+      // d * (255 - a) / 255, two channels at a time
+      uint32_t d = dst[i], ia = 255 - a;
+      uint32_t rb = (d & 0x00ff00ff) * ia + 0x00800080;
+      rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+      uint32_t ag = ((d >> 8) & 0x00ff00ff) * ia + 0x00800080;
+      ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+      dst[i] = s + rb + ag;
+    }
+  }
+}
+
+/*
+ * Draw `source` directly into the target pixels when drawImage()
+ * reduces to an unscaled, integer aligned source-over blit with no
+ * transform beyond a translation, no alpha, no shadow and no clip.
+ * Returns false when cairo has to do the drawing.
+ */
+
+static bool
+blit(Context2d *context, cairo_surface_t *source
+  , float sx, float sy, float sw, float sh
+  , float dx, float dy, float dw, float dh) {
+  cairo_t *ctx = context->context();
+  canvas_state_t *state = context->state;
+  cairo_surface_t *target = cairo_get_target(ctx);
+
+  if (1 != state->globalAlpha
+    || state->hasClip
+    || context->hasShadow()
+    || CAIRO_OPERATOR_OVER != cairo_get_operator(ctx)) return false;
+
+  if (source == target
+    || CAIRO_SURFACE_TYPE_IMAGE != cairo_surface_get_type(source)
+    || CAIRO_SURFACE_TYPE_IMAGE != cairo_surface_get_type(target)
+    || CAIRO_FORMAT_ARGB32 != cairo_image_surface_get_format(target)) return false;
+
+  cairo_format_t format = cairo_image_surface_get_format(source);
+  if (CAIRO_FORMAT_ARGB32 != format && CAIRO_FORMAT_RGB24 != format) return false;
+
+  cairo_matrix_t matrix;
+  cairo_get_matrix(ctx, &matrix);
+  if (1 != matrix.xx || 1 != matrix.yy || 0 != matrix.xy || 0 != matrix.yx) return false;
+
+  double tx = dx + matrix.x0
+    , ty = dy + matrix.y0
+    , limit = 1 << 24;
+  if (dw != sw || dh != sh || sw <= 0 || sh <= 0) return false;
+  if (tx != floor(tx) || ty != floor(ty)
+    || sx != floorf(sx) || sy != floorf(sy)
+    || sw != floorf(sw) || sh != floorf(sh)) return false;
+  if (fabs(tx) > limit || fabs(ty) > limit
+    || fabs(sx) > limit || fabs(sy) > limit
+    || sw > limit || sh > limit) return false;
+
+  int x = tx, y = ty, w = sw, h = sh, srcx = sx, srcy = sy;
+  int source_w = cairo_image_surface_get_width(source)
+    , source_h = cairo_image_surface_get_height(source)
+    , target_w = cairo_image_surface_get_width(target)
+    , target_h = cairo_image_surface_get_height(target);
+
+  // clip to the source, outside of which is transparent
+  if (srcx < 0) x -= srcx, w += srcx, srcx = 0;
+  if (srcy < 0) y -= srcy, h += srcy, srcy = 0;
+  if (srcx + w > source_w) w = source_w - srcx;
+  if (srcy + h > source_h) h = source_h - srcy;
+
+  // clip to the target
+  if (x < 0) srcx -= x, w += x, x = 0;
+  if (y < 0) srcy -= y, h += y, y = 0;
+  if (x + w > target_w) w = target_w - x;
+  if (y + h > target_h) h = target_h - y;
+
+  if (w <= 0 || h <= 0) return true;
+
+  cairo_surface_flush(source);
+  cairo_surface_flush(target);
+
+  uint8_t *src = cairo_image_surface_get_data(source);
+  uint8_t *dst = cairo_image_surface_get_data(target);
+  int src_stride = cairo_image_surface_get_stride(source)
+    , dst_stride = cairo_image_surface_get_stride(target);
+  bool opaque = CAIRO_FORMAT_RGB24 == format;
+
+  src += srcy * src_stride + srcx * 4;
+  dst += y * dst_stride + x * 4;
+  for (int i = 0; i < h; ++i) {
+    blit_row((uint32_t *) dst, (const uint32_t *) src, w, opaque);
+    src += src_stride;
+    dst += dst_stride;
+  }
+
+  cairo_surface_mark_dirty_rectangle(target, x, y, w, h);
+  return true;
+}
+
 /*
  * Draw image src image to the destination (context).
  *
@@ -822,26 +1351,31 @@ NAN_METHOD(Context2d::DrawImage) {
     , sw = 0
     , sh = 0
     , dx, dy, dw, dh;
+  int source_w, source_h;
+  bool immutable = false;
 
   cairo_surface_t *surface;
+  Image *img = NULL;
 
   Local<Object> obj = info[0]->ToObject();
 
   // Image
-  if (Nan::New(Image::constructor)->HasInstance(obj)) {
-    Image *img = Nan::ObjectWrap::Unwrap<Image>(obj);
+  if (Image::constructor.Get()->HasInstance(obj)) {
+    img = Nan::ObjectWrap::Unwrap<Image>(obj);
     if (!img->isComplete()) {
       return Nan::ThrowError("Image given has not completed loading");
     }
-    sw = img->width;
-    sh = img->height;
+    source_w = sw = img->width;
+    source_h = sh = img->height;
     surface = img->surface();
+    immutable = true;
 
   // Canvas
-  } else if (Nan::New(Canvas::constructor)->HasInstance(obj)) {
+  } else if (Canvas::constructor.Get()->HasInstance(obj)) {
     Canvas *canvas = Nan::ObjectWrap::Unwrap<Canvas>(obj);
-    sw = canvas->width;
-    sh = canvas->height;
+    CANVAS_CHECK_ATTACHED(canvas);
+    source_w = sw = canvas->width;
+    source_h = sh = canvas->height;
     surface = canvas->surface();
 
   // Invalid
@@ -850,6 +1384,7 @@ NAN_METHOD(Context2d::DrawImage) {
   }
 
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  CANVAS_CHECK_ATTACHED(context->canvas());
   cairo_t *ctx = context->context();
 
   // Arguments
@@ -883,6 +1418,36 @@ NAN_METHOD(Context2d::DrawImage) {
       return Nan::ThrowTypeError("invalid arguments");
   }
 
+  // Reductions of 2x or more sample the nearest mip level of
+  // the image, filtering only the remaining reduction
+  if (img && SMOOTHING_QUALITY_LOW != context->state->imageSmoothingQuality) {
+    cairo_matrix_t matrix;
+    cairo_get_matrix(ctx, &matrix);
+    double scale = (std::max)(
+        sqrt(matrix.xx * matrix.xx + matrix.yx * matrix.yx) * fabs(dw / sw)
+      , sqrt(matrix.xy * matrix.xy + matrix.yy * matrix.yy) * fabs(dh / sh));
+
+    int level = 0;
+    while (scale > 0 && scale <= 0.5) scale *= 2, ++level;
+
+    cairo_surface_t *mip = img->mip(level);
+    if (mip) {
+      int mip_w = cairo_image_surface_get_width(mip)
+        , mip_h = cairo_image_surface_get_height(mip);
+      sx = (double) sx * mip_w / source_w;
+      sw = (double) sw * mip_w / source_w;
+      sy = (double) sy * mip_h / source_h;
+      sh = (double) sh * mip_h / source_h;
+      source_w = mip_w;
+      source_h = mip_h;
+      surface = mip;
+    }
+  }
+
+  context->damage(dx, dy, dx + dw, dy + dh);
+  context->canvas()->drawsSurfaces = true;
+  if (blit(context, surface, sx, sy, sw, sh, dx, dy, dw, dh)) return;
+
   // Start draw
   cairo_save(ctx);
 
@@ -901,28 +1466,45 @@ NAN_METHOD(Context2d::DrawImage) {
   // apply shadow if there is one
   if (context->hasShadow()) {
     if(context->state->shadowBlur) {
-      // we need to create a new surface in order to blur
       int pad = context->state->shadowBlur * 2;
-      cairo_surface_t *shadow_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, dw + 2 * pad, dh + 2 * pad);
-      cairo_t *shadow_context = cairo_create(shadow_surface);
+      canvas_state_t *state = context->state;
+
+      // Images don't change once loaded, so their masks are cached
+      // until the image surface is destroyed
+      shadow_key_t key;
+      key.source = immutable ? surface : NULL;
+      cairo_surface_t *shadow_surface = NULL;
+
+      if (key.source) {
+        key.data.push_back((int) dw);
+        key.data.push_back((int) dh);
+        key.data.push_back(state->shadowBlur);
+        shadow_surface = shadow_cache_lookup(key);
+      }
+
+      if (!shadow_surface) {
+        // we need to create a new surface in order to blur,
+        // holding just the alpha of the image
+        shadow_surface = cairo_image_surface_create(CAIRO_FORMAT_A8, dw + 2 * pad, dh + 2 * pad);
+        cairo_t *shadow_context = cairo_create(shadow_surface);
 
-      // mask and blur
-      context->setSourceRGBA(shadow_context, context->state->shadow);
-      cairo_mask_surface(shadow_context, surface, pad, pad);
-      context->blur(shadow_surface, context->state->shadowBlur);
+        // mask and blur
+        cairo_mask_surface(shadow_context, surface, pad, pad);
+        cairo_destroy(shadow_context);
+        context->blur(shadow_surface, state->shadowBlur);
+
+        if (key.source) shadow_cache_insert(key, shadow_surface);
+      }
 
       // paint
       // @note: ShadowBlur looks different in each browser. This implementation matches chrome as close as possible.
       //        The 1.4 offset comes from visual tests with Chrome. I have read the spec and part of the shadowBlur
       //        implementation, and its not immediately clear why an offset is necessary, but without it, the result
       //        in chrome is different.
-      cairo_set_source_surface(ctx, shadow_surface,
+      context->setSourceRGBA(state->shadow);
+      cairo_mask_surface(ctx, shadow_surface,
         dx - sx + (context->state->shadowOffsetX / fx) - pad + 1.4,
         dy - sy + (context->state->shadowOffsetY / fy) - pad + 1.4);
-      cairo_paint(ctx);
-
-      // cleanup
-      cairo_destroy(shadow_context);
       cairo_surface_destroy(shadow_surface);
     } else {
       context->setSourceRGBA(context->state->shadow);
@@ -932,17 +1514,51 @@ NAN_METHOD(Context2d::DrawImage) {
     }
   }
 
-  context->savePath();
-  cairo_rectangle(ctx, dx, dy, dw, dh);
-  cairo_clip(ctx);
-  context->restorePath();
+  // Painting the whole source needs no clip since the pattern
+  // doesn't extend, as long as it's sampled pixel for pixel or by
+  // the nearest pixel. Otherwise filtering spreads the edge pixels
+  // past the destination. Integer crops within the source paint
+  // from a subsurface instead. Either way the user path is untouched.
+  cairo_matrix_t matrix;
+  cairo_get_matrix(ctx, &matrix);
+  cairo_filter_t filter = context->state->patternQuality;
+  bool unfiltered = CAIRO_FILTER_NEAREST == filter
+    || CAIRO_FILTER_FAST == filter
+    || (1 == matrix.xx && 0 == matrix.yx && 0 == matrix.xy && 1 == matrix.yy
+      && matrix.x0 + dx == floor(matrix.x0 + dx)
+      && matrix.y0 + dy == floor(matrix.y0 + dy));
+  bool whole = 0 == sx && 0 == sy && source_w == sw && source_h == sh;
+  cairo_surface_t *cropped = NULL;
+
+#if CAIRO_VERSION_MINOR >= 10
+  if (!whole
+    && sx >= 0 && sy >= 0
+    && sx + sw <= source_w && sy + sh <= source_h
+    && sx == floorf(sx) && sy == floorf(sy)
+    && sw == floorf(sw) && sh == floorf(sh)) {
+    cropped = cairo_surface_create_for_rectangle(surface, sx, sy, sw, sh);
+  }
+#endif
+
+  if (!unfiltered || (!whole && !cropped)) {
+    context->savePath();
+    cairo_rectangle(ctx, dx, dy, dw, dh);
+    cairo_clip(ctx);
+    context->restorePath();
+  }
+
+  if (cropped) {
+    cairo_set_source_surface(ctx, cropped, dx, dy);
+  } else {
+    cairo_set_source_surface(ctx, surface, dx - sx, dy - sy);
+  }
 
   // Paint
-  cairo_set_source_surface(ctx, surface, dx - sx, dy - sy);
-  cairo_pattern_set_filter(cairo_get_source(ctx), context->state->patternQuality);
+  cairo_pattern_set_filter(cairo_get_source(ctx), filter);
   cairo_paint_with_alpha(ctx, context->state->globalAlpha);
 
   cairo_restore(ctx);
+  if (cropped) cairo_surface_destroy(cropped);
 }
 
 /*
@@ -1053,6 +1669,38 @@ NAN_GETTER(Context2d::GetPatternQuality) {
   info.GetReturnValue().Set(Nan::New(quality).ToLocalChecked());
 }
 
+/*
+ * Set image smoothing quality. "medium" and "high" draw large image
+ * reductions from the image's mip chain.
+ */
+
+NAN_SETTER(Context2d::SetImageSmoothingQuality) {
+  String::Utf8Value quality(value->ToString());
+  Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  if (0 == strcmp("low", *quality)) {
+    context->state->imageSmoothingQuality = SMOOTHING_QUALITY_LOW;
+  } else if (0 == strcmp("medium", *quality)) {
+    context->state->imageSmoothingQuality = SMOOTHING_QUALITY_MEDIUM;
+  } else if (0 == strcmp("high", *quality)) {
+    context->state->imageSmoothingQuality = SMOOTHING_QUALITY_HIGH;
+  }
+}
+
+/*
+ * Get image smoothing quality.
+ */
+
+NAN_GETTER(Context2d::GetImageSmoothingQuality) {
+  Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  const char *quality;
+  switch (context->state->imageSmoothingQuality) {
+    case SMOOTHING_QUALITY_MEDIUM: quality = "medium"; break;
+    case SMOOTHING_QUALITY_HIGH: quality = "high"; break;
+    default: quality = "low";
+  }
+  info.GetReturnValue().Set(Nan::New(quality).ToLocalChecked());
+}
+
 /*
  * Set global composite operation.
  */
@@ -1407,6 +2055,20 @@ NAN_SETTER(Context2d::SetLineCap) {
  */
 
 NAN_METHOD(Context2d::IsPointInPath) {
+  Path2D *path = unwrapPath(info[0]);
+  if (path && info[1]->IsNumber() && info[2]->IsNumber()) {
+    Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+    cairo_t *ctx = context->context();
+    double x = info[1]->NumberValue()
+         , y = info[2]->NumberValue();
+    context->savePath();
+    path->append(ctx);
+    context->setFillRule(info[3]);
+    bool inside = cairo_in_fill(ctx, x, y) || cairo_in_stroke(ctx, x, y);
+    context->restorePath();
+    info.GetReturnValue().Set(Nan::New<Boolean>(inside));
+    return;
+  }
   if (info[0]->IsNumber() && info[1]->IsNumber()) {
     Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
     cairo_t *ctx = context->context();
@@ -1425,11 +2087,11 @@ NAN_METHOD(Context2d::IsPointInPath) {
 
 NAN_METHOD(Context2d::SetFillPattern) {
   Local<Object> obj = info[0]->ToObject();
-  if (Nan::New(Gradient::constructor)->HasInstance(obj)){
+  if (Gradient::constructor.Get()->HasInstance(obj)){
     Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
     Gradient *grad = Nan::ObjectWrap::Unwrap<Gradient>(obj);
     context->state->fillGradient = grad->pattern();
-  } else if(Nan::New(Pattern::constructor)->HasInstance(obj)){
+  } else if(Pattern::constructor.Get()->HasInstance(obj)){
     Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
     Pattern *pattern = Nan::ObjectWrap::Unwrap<Pattern>(obj);
     context->state->fillPattern = pattern->pattern();
@@ -1444,11 +2106,11 @@ NAN_METHOD(Context2d::SetFillPattern) {
 
 NAN_METHOD(Context2d::SetStrokePattern) {
   Local<Object> obj = info[0]->ToObject();
-  if (Nan::New(Gradient::constructor)->HasInstance(obj)){
+  if (Gradient::constructor.Get()->HasInstance(obj)){
     Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
     Gradient *grad = Nan::ObjectWrap::Unwrap<Gradient>(obj);
     context->state->strokeGradient = grad->pattern();
-  } else if(Nan::New(Pattern::constructor)->HasInstance(obj)){
+  } else if(Pattern::constructor.Get()->HasInstance(obj)){
     Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
     Pattern *pattern = Nan::ObjectWrap::Unwrap<Pattern>(obj);
     context->state->strokePattern = pattern->pattern();
@@ -1567,26 +2229,11 @@ NAN_METHOD(Context2d::QuadraticCurveTo) {
     ||!info[3]->IsNumber()) return;
 
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
-  cairo_t *ctx = context->context();
-
-  double x, y
-    , x1 = info[0]->NumberValue()
-    , y1 = info[1]->NumberValue()
-    , x2 = info[2]->NumberValue()
-    , y2 = info[3]->NumberValue();
-
-  cairo_get_current_point(ctx, &x, &y);
-
-  if (0 == x && 0 == y) {
-    x = x1;
-    y = y1;
-  }
-
-  cairo_curve_to(ctx
-    , x  + 2.0 / 3.0 * (x1 - x),  y  + 2.0 / 3.0 * (y1 - y)
-    , x2 + 2.0 / 3.0 * (x1 - x2), y2 + 2.0 / 3.0 * (y1 - y2)
-    , x2
-    , y2);
+  canvas_quadratic_curve_to(context->context()
+    , info[0]->NumberValue()
+    , info[1]->NumberValue()
+    , info[2]->NumberValue()
+    , info[3]->NumberValue());
 }
 
 /*
@@ -1690,28 +2337,57 @@ NAN_METHOD(Context2d::Scale) {
 
 NAN_METHOD(Context2d::Clip) {
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
-  context->setFillRule(info[0]);
   cairo_t *ctx = context->context();
-  cairo_clip_preserve(ctx);
+  Path2D *path = unwrapPath(info[0]);
+  context->state->hasClip = true;
+  if (path) {
+    context->savePath();
+    path->append(ctx);
+    context->setFillRule(info[1]);
+    cairo_clip(ctx);
+    context->restorePath();
+  } else {
+    context->setFillRule(info[0]);
+    cairo_clip_preserve(ctx);
+  }
 }
 
 /*
- * Fill the path.
+ * Fill the path, or the given Path2D.
  */
 
 NAN_METHOD(Context2d::Fill) {
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
-  context->setFillRule(info[0]);
-  context->fill(true);
+  CANVAS_CHECK_ATTACHED(context->canvas());
+  Path2D *path = unwrapPath(info[0]);
+  if (path) {
+    context->savePath();
+    path->append(context->context());
+    context->setFillRule(info[1]);
+    context->fill();
+    context->restorePath();
+  } else {
+    context->setFillRule(info[0]);
+    context->fill(true);
+  }
 }
 
 /*
- * Stroke the path.
+ * Stroke the path, or the given Path2D.
  */
 
 NAN_METHOD(Context2d::Stroke) {
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
-  context->stroke(true);
+  CANVAS_CHECK_ATTACHED(context->canvas());
+  Path2D *path = unwrapPath(info[0]);
+  if (path) {
+    context->savePath();
+    path->append(context->context());
+    context->stroke();
+    context->restorePath();
+  } else {
+    context->stroke(true);
+  }
 }
 
 /*
@@ -1727,6 +2403,7 @@ NAN_METHOD(Context2d::FillText) {
   double y = info[2]->NumberValue();
 
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  CANVAS_CHECK_ATTACHED(context->canvas());
 
   context->savePath();
   if (context->state->textDrawingMode == TEXT_DRAW_GLYPHS) {
@@ -1752,6 +2429,7 @@ NAN_METHOD(Context2d::StrokeText) {
   double y = info[2]->NumberValue();
 
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  CANVAS_CHECK_ATTACHED(context->canvas());
 
   context->savePath();
   if (context->state->textDrawingMode == TEXT_DRAW_GLYPHS) {
@@ -1764,6 +2442,83 @@ NAN_METHOD(Context2d::StrokeText) {
   context->restorePath();
 }
 
+/*
+ * Fill each of `strings` at (xs[i], ys[i]) with a single
+ * path save, as if fillText() was called for each.
+ */
+
+NAN_METHOD(Context2d::FillTextBatch) {
+  if (!info[0]->IsArray())
+    return Nan::ThrowTypeError("strings must be an Array");
+  if (!info[1]->IsFloat64Array() || !info[2]->IsFloat64Array())
+    return Nan::ThrowTypeError("xs and ys must be Float64Arrays");
+
+  Local<Array> strings = info[0].As<Array>();
+  Nan::TypedArrayContents<double> xs(info[1]);
+  Nan::TypedArrayContents<double> ys(info[2]);
+  uint32_t n = strings->Length();
+
+  if (xs.length() < n || ys.length() < n)
+    return Nan::ThrowRangeError("xs and ys must hold a position per string");
+
+  Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  CANVAS_CHECK_ATTACHED(context->canvas());
+
+  context->savePath();
+  if (context->state->textDrawingMode == TEXT_DRAW_GLYPHS) {
+    context->fill();
+    for (uint32_t i = 0; i < n; ++i) {
+      String::Utf8Value str(strings->Get(i)->ToString());
+      context->setTextPath(*str, (*xs)[i], (*ys)[i]);
+    }
+  } else if (context->state->textDrawingMode == TEXT_DRAW_PATHS) {
+    for (uint32_t i = 0; i < n; ++i) {
+      String::Utf8Value str(strings->Get(i)->ToString());
+      context->setTextPath(*str, (*xs)[i], (*ys)[i]);
+      context->fill();
+    }
+  }
+  context->restorePath();
+}
+
+/*
+ * Return the width of each of `strings` as a Float64Array.
+ */
+
+NAN_METHOD(Context2d::MeasureTextBatch) {
+  if (!info[0]->IsArray())
+    return Nan::ThrowTypeError("strings must be an Array");
+
+  Local<Array> strings = info[0].As<Array>();
+  uint32_t n = strings->Length();
+  Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+
+#if NODE_MAJOR_VERSION == 0 && NODE_MINOR_VERSION <= 10
+  Local<Object> global = Context::GetCurrent()->Global();
+  Local<Value> argv[] = { Nan::New<Uint32>(n) };
+  Local<Object> widths = global->Get(Nan::New("Float64Array").ToLocalChecked()).As<Function>()->NewInstance(1, argv);
+#else
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(Isolate::GetCurrent(), n * sizeof(double));
+  Local<Float64Array> widths = Float64Array::New(buffer, 0, n);
+#endif
+
+  Nan::TypedArrayContents<double> contents(widths);
+  double *dst = *contents;
+
+  for (uint32_t i = 0; i < n; ++i) {
+    String::Utf8Value str(strings->Get(i)->ToString());
+#if HAVE_PANGO
+    dst[i] = text_layout_lookup(context, *str)->logical_rect.width;
+#else
+    cairo_text_extents_t te;
+    cairo_text_extents(context->context(), *str, &te);
+    dst[i] = te.x_advance;
+#endif
+  }
+
+  info.GetReturnValue().Set(widths);
+}
+
 /*
  * Set text path for the given string at (x, y).
  */
@@ -1772,47 +2527,41 @@ void
 Context2d::setTextPath(const char *str, double x, double y) {
 #if HAVE_PANGO
 
-  PangoRectangle ink_rect, logical_rect;
-  PangoFontMetrics *metrics = NULL;
-
-  pango_layout_set_text(_layout, str, -1);
-  pango_cairo_update_layout(_context, _layout);
+  text_layout_t *text = text_layout_lookup(this, str);
 
   switch (state->textAlignment) {
     // center
     case 0:
-      pango_layout_get_pixel_extents(_layout, &ink_rect, &logical_rect);
-      x -= logical_rect.width / 2;
+      x -= text->logical_rect.width / 2;
       break;
     // right
     case 1:
-      pango_layout_get_pixel_extents(_layout, &ink_rect, &logical_rect);
-      x -= logical_rect.width;
+      x -= text->logical_rect.width;
       break;
   }
 
   switch (state->textBaseline) {
     case TEXT_BASELINE_ALPHABETIC:
-      metrics = PANGO_LAYOUT_GET_METRICS(_layout);
-      y -= pango_font_metrics_get_ascent(metrics) / PANGO_SCALE;
+      y -= text->ascent / PANGO_SCALE;
       break;
     case TEXT_BASELINE_MIDDLE:
-      metrics = PANGO_LAYOUT_GET_METRICS(_layout);
-      y -= (pango_font_metrics_get_ascent(metrics) + pango_font_metrics_get_descent(metrics))/(2.0 * PANGO_SCALE);
+      y -= (text->ascent + text->descent)/(2.0 * PANGO_SCALE);
       break;
     case TEXT_BASELINE_BOTTOM:
-      metrics = PANGO_LAYOUT_GET_METRICS(_layout);
-      y -= (pango_font_metrics_get_ascent(metrics) + pango_font_metrics_get_descent(metrics)) / PANGO_SCALE;
+      y -= (text->ascent + text->descent) / PANGO_SCALE;
       break;
   }
 
-  if (metrics) pango_font_metrics_unref(metrics);
-
-  cairo_move_to(_context, x, y);
+  cairo_move_to(context(), x, y);
   if (state->textDrawingMode == TEXT_DRAW_PATHS) {
-    pango_cairo_layout_path(_context, _layout);
+    pango_cairo_layout_path(context(), text->layout);
   } else if (state->textDrawingMode == TEXT_DRAW_GLYPHS) {
-    pango_cairo_show_layout(_context, _layout);
+    damage(
+        x + text->ink_rect.x - 1
+      , y + text->ink_rect.y - 1
+      , x + text->ink_rect.x + text->ink_rect.width + 1
+      , y + text->ink_rect.y + text->ink_rect.height + 1);
+    pango_cairo_show_layout(context(), text->layout);
   }
 
 #else
@@ -1825,13 +2574,13 @@ Context2d::setTextPath(const char *str, double x, double y) {
     // center
     case 0:
       // Olaf (2011-02-19): te.x_bearing does not concern the alignment
-      cairo_text_extents(_context, str, &te);
+      cairo_text_extents(context(), str, &te);
       x -= te.width / 2;
       break;
     // right
     case 1:
       // Olaf (2011-02-19): te.x_bearing does not concern the alignment
-      cairo_text_extents(_context, str, &te);
+      cairo_text_extents(context(), str, &te);
       x -= te.width;
       break;
   }
@@ -1842,28 +2591,34 @@ Context2d::setTextPath(const char *str, double x, double y) {
     case TEXT_BASELINE_HANGING:
       // Olaf (2011-02-26): fe.ascent approximates the distance between
       // the top of the em square and the alphabetic baseline
-      cairo_font_extents(_context, &fe);
+      cairo_font_extents(context(), &fe);
       y += fe.ascent;
       break;
     case TEXT_BASELINE_MIDDLE:
       // Olaf (2011-02-26): fe.ascent approximates the distance between
       // the top of the em square and the alphabetic baseline
-      cairo_font_extents(_context, &fe);
+      cairo_font_extents(context(), &fe);
       y += (fe.ascent - fe.descent)/2;
       break;
     case TEXT_BASELINE_BOTTOM:
       // Olaf (2011-02-26): we need to know the distance between the alphabetic
       // baseline and the bottom of the em square
-      cairo_font_extents(_context, &fe);
+      cairo_font_extents(context(), &fe);
       y -= fe.descent;
       break;
   }
 
-  cairo_move_to(_context, x, y);
+  cairo_move_to(context(), x, y);
   if (state->textDrawingMode == TEXT_DRAW_PATHS) {
-    cairo_text_path(_context, str);
+    cairo_text_path(context(), str);
   } else if (state->textDrawingMode == TEXT_DRAW_GLYPHS) {
-    cairo_show_text(_context, str);
+    cairo_text_extents(context(), str, &te);
+    damage(
+        x + te.x_bearing - 1
+      , y + te.y_bearing - 1
+      , x + te.x_bearing + te.width + 1
+      , y + te.y_bearing + te.height + 1);
+    cairo_show_text(context(), str);
   }
 
 #endif
@@ -1901,6 +2656,273 @@ NAN_METHOD(Context2d::MoveTo) {
     , info[1]->NumberValue());
 }
 
+/*
+ * Adds a polyline through the x, y pairs of a Float64Array:
+ *
+ *   polyline(xy[, closed[, simplify]])
+ *
+ * NaN coordinates start a new subpath. With `simplify`, points
+ * falling in the same device pixel as the previous one are skipped.
+ */
+
+NAN_METHOD(Context2d::Polyline) {
+  if (!info[0]->IsFloat64Array())
+    return Nan::ThrowTypeError("polyline() xy must be a Float64Array");
+
+  Nan::TypedArrayContents<double> xy(info[0]);
+  Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  canvas_polyline(context->context()
+    , *xy
+    , xy.length() / 2
+    , info[1]->BooleanValue()
+    , info[2]->BooleanValue());
+}
+
+/*
+ * Adds closed rings from the x, y pairs of a Float64Array, where ring
+ * i starts at point offsets[i] and ends before offsets[i + 1]:
+ *
+ *   polygons(xy, offsets[, simplify])
+ */
+
+NAN_METHOD(Context2d::Polygons) {
+  if (!info[0]->IsFloat64Array())
+    return Nan::ThrowTypeError("polygons() xy must be a Float64Array");
+  if (!info[1]->IsUint32Array())
+    return Nan::ThrowTypeError("polygons() offsets must be a Uint32Array");
+
+  Nan::TypedArrayContents<double> xy(info[0]);
+  Nan::TypedArrayContents<uint32_t> offsets(info[1]);
+  size_t n = xy.length() / 2
+    , rings = offsets.length();
+
+  for (size_t i = 0; i < rings; ++i) {
+    size_t end = i + 1 < rings ? (*offsets)[i + 1] : n;
+    if ((*offsets)[i] > end || end > n)
+      return Nan::ThrowRangeError("polygons() offsets must be ascending and within xy");
+  }
+
+  Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  bool simplify = info[2]->BooleanValue();
+  for (size_t i = 0; i < rings; ++i) {
+    size_t start = (*offsets)[i]
+      , end = i + 1 < rings ? (*offsets)[i + 1] : n;
+    canvas_polyline(context->context(), *xy + start * 2, end - start, true, simplify);
+  }
+}
+
+/*
+ * Command buffer opcodes, mirrored by CommandBuffer in lib/context2d.js.
+ * Each command is its opcode followed by its operands, all stored as
+ * doubles so the buffer is a plain Float64Array.
+ */
+
+typedef enum {
+  CMD_SAVE = 1,
+  CMD_RESTORE,
+  CMD_BEGIN_PATH,
+  CMD_CLOSE_PATH,
+  CMD_MOVE_TO,
+  CMD_LINE_TO,
+  CMD_BEZIER_CURVE_TO,
+  CMD_QUADRATIC_CURVE_TO,
+  CMD_ARC,
+  CMD_ARC_TO,
+  CMD_RECT,
+  CMD_POLYLINE,
+  CMD_FILL,
+  CMD_STROKE,
+  CMD_CLIP,
+  CMD_FILL_RECT,
+  CMD_STROKE_RECT,
+  CMD_CLEAR_RECT,
+  CMD_TRANSLATE,
+  CMD_SCALE,
+  CMD_ROTATE,
+  CMD_TRANSFORM,
+  CMD_SET_TRANSFORM,
+  CMD_FILL_COLOR,
+  CMD_STROKE_COLOR,
+  CMD_LINE_WIDTH,
+  CMD_GLOBAL_ALPHA,
+  CMD_MAX
+} canvas_command_t;
+
+/*
+ * Operand count of each opcode. CMD_POLYLINE is followed by
+ * `n, closed` and then n x, y pairs.
+ */
+
+static const uint8_t command_operands[CMD_MAX] = {
+    0, 0, 0, 0, 0, 2, 2, 6, 4, 6, 5, 4, 2
+  , 1, 0, 1, 4, 4, 4, 2, 2, 1, 6, 6, 4
+  , 4, 1, 1
+};
+
+/*
+ * Colors are given as r, g, b in [0, 255] and alpha in [0, 1].
+ */
+
+static inline rgba_t
+command_color(const double *op) {
+  rgba_t color;
+  color.r = (std::max)(0.0, (std::min)(255.0, op[0])) / 255;
+  color.g = (std::max)(0.0, (std::min)(255.0, op[1])) / 255;
+  color.b = (std::max)(0.0, (std::min)(255.0, op[2])) / 255;
+  color.a = (std::max)(0.0, (std::min)(1.0, op[3]));
+  return color;
+}
+
+/*
+ * Run a command buffer produced by CommandBuffer:
+ *
+ *   _execute(commands, length)
+ *
+ * Only the first `length` doubles of `commands` are decoded.
+ */
+
+NAN_METHOD(Context2d::Execute) {
+  if (!info[0]->IsFloat64Array())
+    return Nan::ThrowTypeError("execute() commands must be a Float64Array");
+
+  Nan::TypedArrayContents<double> commands(info[0]);
+  size_t len = commands.length();
+  if (info[1]->IsNumber()) len = (std::min)(len, (size_t) info[1]->Uint32Value());
+
+  Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  CANVAS_CHECK_ATTACHED(context->canvas());
+  cairo_t *ctx = context->context();
+  const double *buf = *commands;
+  size_t i = 0;
+
+  while (i < len) {
+    double code = buf[i];
+    if (!(code >= 1 && code < CMD_MAX) || code != (int) code)
+      return Nan::ThrowTypeError("execute() invalid opcode");
+
+    size_t n = command_operands[(int) code];
+    if (i + 1 + n > len)
+      return Nan::ThrowRangeError("execute() truncated command");
+
+    const double *op = buf + i + 1;
+    i += 1 + n;
+
+    switch ((int) code) {
+      case CMD_SAVE:
+        context->save();
+        break;
+      case CMD_RESTORE:
+        context->restore();
+        break;
+      case CMD_BEGIN_PATH:
+        cairo_new_path(ctx);
+        break;
+      case CMD_CLOSE_PATH:
+        cairo_close_path(ctx);
+        break;
+      case CMD_MOVE_TO:
+        cairo_move_to(ctx, op[0], op[1]);
+        break;
+      case CMD_LINE_TO:
+        cairo_line_to(ctx, op[0], op[1]);
+        break;
+      case CMD_BEZIER_CURVE_TO:
+        cairo_curve_to(ctx, op[0], op[1], op[2], op[3], op[4], op[5]);
+        break;
+      case CMD_QUADRATIC_CURVE_TO:
+        canvas_quadratic_curve_to(ctx, op[0], op[1], op[2], op[3]);
+        break;
+      case CMD_ARC:
+        canvas_arc(ctx, op[0], op[1], op[2], op[3], op[4], op[5] != 0);
+        break;
+      case CMD_ARC_TO:
+        canvas_arc_to(ctx, op[0], op[1], op[2], op[3], op[4]);
+        break;
+      case CMD_RECT:
+        canvas_rect(ctx, op[0], op[1], op[2], op[3]);
+        break;
+      case CMD_POLYLINE: {
+        if (!(op[0] >= 0) || op[0] > (len - i) / 2)
+          return Nan::ThrowRangeError("execute() truncated command");
+        size_t points = (size_t) op[0];
+        canvas_polyline(ctx, buf + i, points, op[1] != 0, false);
+        i += points * 2;
+        break;
+      }
+      case CMD_FILL:
+        cairo_set_fill_rule(ctx, op[0] ? CAIRO_FILL_RULE_EVEN_ODD : CAIRO_FILL_RULE_WINDING);
+        context->fill(true);
+        break;
+      case CMD_STROKE:
+        context->stroke(true);
+        break;
+      case CMD_CLIP:
+        cairo_set_fill_rule(ctx, op[0] ? CAIRO_FILL_RULE_EVEN_ODD : CAIRO_FILL_RULE_WINDING);
+        cairo_clip_preserve(ctx);
+        context->state->hasClip = true;
+        break;
+      case CMD_FILL_RECT:
+        if (0 == op[2] || 0 == op[3]) break;
+        context->savePath();
+        cairo_rectangle(ctx, op[0], op[1], op[2], op[3]);
+        context->fill();
+        context->restorePath();
+        break;
+      case CMD_STROKE_RECT:
+        if (0 == op[2] && 0 == op[3]) break;
+        context->savePath();
+        cairo_rectangle(ctx, op[0], op[1], op[2], op[3]);
+        context->stroke();
+        context->restorePath();
+        break;
+      case CMD_CLEAR_RECT:
+        if (0 == op[2] || 0 == op[3]) break;
+        cairo_save(ctx);
+        context->savePath();
+        cairo_rectangle(ctx, op[0], op[1], op[2], op[3]);
+        cairo_set_operator(ctx, CAIRO_OPERATOR_CLEAR);
+        context->damagePath(false);
+        cairo_fill(ctx);
+        context->restorePath();
+        cairo_restore(ctx);
+        break;
+      case CMD_TRANSLATE:
+        cairo_translate(ctx, op[0], op[1]);
+        break;
+      case CMD_SCALE:
+        cairo_scale(ctx, op[0], op[1]);
+        break;
+      case CMD_ROTATE:
+        cairo_rotate(ctx, op[0]);
+        break;
+      case CMD_TRANSFORM:
+      case CMD_SET_TRANSFORM: {
+        cairo_matrix_t matrix;
+        cairo_matrix_init(&matrix, op[0], op[1], op[2], op[3], op[4], op[5]);
+        if (CMD_SET_TRANSFORM == code) cairo_identity_matrix(ctx);
+        cairo_transform(ctx, &matrix);
+        break;
+      }
+      case CMD_FILL_COLOR:
+        context->state->fillPattern = context->state->fillGradient = NULL;
+        context->state->fill = command_color(op);
+        break;
+      case CMD_STROKE_COLOR:
+        context->state->strokePattern = context->state->strokeGradient = NULL;
+        context->state->stroke = command_color(op);
+        break;
+      case CMD_LINE_WIDTH:
+        if (op[0] > 0 && op[0] != std::numeric_limits<double>::infinity())
+          cairo_set_line_width(ctx, op[0]);
+        break;
+      case CMD_GLOBAL_ALPHA:
+        if (op[0] >= 0 && op[0] <= 1)
+          context->state->globalAlpha = op[0];
+        break;
+    }
+  }
+}
+
 /*
  * Set font face.
  */
@@ -1914,7 +2936,7 @@ NAN_METHOD(Context2d::SetFontFace) {
 
   Local<Object> obj = info[0]->ToObject();
 
-  if (!Nan::New(FontFace::constructor)->HasInstance(obj))
+  if (!FontFace::constructor.Get()->HasInstance(obj))
     return Nan::ThrowTypeError("FontFace expected");
 
   FontFace *face = Nan::ObjectWrap::Unwrap<FontFace>(obj);
@@ -2026,24 +3048,108 @@ NAN_METHOD(Context2d::SetFont) {
 #if HAVE_PANGO
 
 /*
- * Sets PangoLayout options from the current font state
+ * Sets PangoLayout options from the current font state. Setting
+ * a description flushes the layout's font caches, so this is a
+ * no-op when the effective font is unchanged.
  */
 
 void
 Context2d::setFontFromState() {
-  PangoFontDescription *fd = pango_font_description_new();
+  if (_layoutFontFamily == state->fontFamily
+    && _layoutFontSize == state->fontSize
+    && _layoutFontStyle == state->fontStyle
+    && _layoutFontWeight == state->fontWeight) {
+    font_description_skips++;
+    return;
+  }
+
+  font_description_key_t key;
+  key.family = state->fontFamily;
+  key.size = state->fontSize;
+  key.style = state->fontStyle;
+  key.weight = state->fontWeight;
 
-  pango_font_description_set_family(fd, state->fontFamily);
-  pango_font_description_set_absolute_size(fd, state->fontSize * PANGO_SCALE);
-  pango_font_description_set_style(fd, state->fontStyle);
-  pango_font_description_set_weight(fd, state->fontWeight);
+  pango_layout_set_font_description(_layout, font_description_lookup(key));
 
-  pango_layout_set_font_description(_layout, fd);
-  pango_font_description_free(fd);
+  font_family_retain(state->fontFamily);
+  font_family_release(_layoutFontFamily);
+  _layoutFontFamily = state->fontFamily;
+  _layoutFontSize = state->fontSize;
+  _layoutFontStyle = state->fontStyle;
+  _layoutFontWeight = state->fontWeight;
 }
 
 #endif
 
+/*
+ * Return font description cache statistics shared by all contexts:
+ * { hits, misses, skips, size } where `skips` counts layout updates
+ * avoided because the font did not change.
+ */
+
+NAN_METHOD(Context2d::FontCacheStats) {
+  Local<Object> stats = Nan::New<Object>();
+#if HAVE_PANGO
+  Nan::Set(stats, Nan::New("hits").ToLocalChecked(), Nan::New<Uint32>(font_description_hits));
+  Nan::Set(stats, Nan::New("misses").ToLocalChecked(), Nan::New<Uint32>(font_description_misses));
+  Nan::Set(stats, Nan::New("skips").ToLocalChecked(), Nan::New<Uint32>(font_description_skips));
+  Nan::Set(stats, Nan::New("size").ToLocalChecked(), Nan::New<Uint32>((uint32_t) font_description_lru.size()));
+#else
+  Nan::Set(stats, Nan::New("hits").ToLocalChecked(), Nan::New<Uint32>(0));
+  Nan::Set(stats, Nan::New("misses").ToLocalChecked(), Nan::New<Uint32>(0));
+  Nan::Set(stats, Nan::New("skips").ToLocalChecked(), Nan::New<Uint32>(0));
+  Nan::Set(stats, Nan::New("size").ToLocalChecked(), Nan::New<Uint32>(0));
+#endif
+  info.GetReturnValue().Set(stats);
+}
+
+/*
+ * Return shaped text cache statistics shared by all contexts:
+ * { hits, misses, size }.
+ */
+
+NAN_METHOD(Context2d::TextLayoutCacheStats) {
+  uint32_t hits = 0, misses = 0, size = 0;
+#if HAVE_PANGO
+  text_layout_cache_stats(&hits, &misses, &size);
+#endif
+  Local<Object> stats = Nan::New<Object>();
+  Nan::Set(stats, Nan::New("hits").ToLocalChecked(), Nan::New<Uint32>(hits));
+  Nan::Set(stats, Nan::New("misses").ToLocalChecked(), Nan::New<Uint32>(misses));
+  Nan::Set(stats, Nan::New("size").ToLocalChecked(), Nan::New<Uint32>(size));
+  info.GetReturnValue().Set(stats);
+}
+
+/*
+ * Return shadow mask cache statistics shared by all contexts:
+ * { hits, misses, size, bytes, limit }.
+ */
+
+NAN_METHOD(Context2d::ShadowCacheStats) {
+  uint32_t hits, misses, size;
+  size_t bytes;
+  shadow_cache_stats(&hits, &misses, &size, &bytes);
+  Local<Object> stats = Nan::New<Object>();
+  Nan::Set(stats, Nan::New("hits").ToLocalChecked(), Nan::New<Uint32>(hits));
+  Nan::Set(stats, Nan::New("misses").ToLocalChecked(), Nan::New<Uint32>(misses));
+  Nan::Set(stats, Nan::New("size").ToLocalChecked(), Nan::New<Uint32>(size));
+  Nan::Set(stats, Nan::New("bytes").ToLocalChecked(), Nan::New<Number>((double) bytes));
+  Nan::Set(stats, Nan::New("limit").ToLocalChecked(), Nan::New<Number>((double) shadow_cache_limit()));
+  info.GetReturnValue().Set(stats);
+}
+
+/*
+ * Set the byte budget of the shadow mask cache, 0 disables it.
+ */
+
+NAN_METHOD(Context2d::SetShadowCacheLimit) {
+  double limit = info[0]->NumberValue();
+  if (!info[0]->IsNumber() || !(limit >= 0))
+    return Nan::ThrowTypeError("limit must be a positive number");
+  // Infinity and anything past SIZE_MAX lift the limit
+  shadow_cache_set_limit(limit >= (double) SIZE_MAX ? SIZE_MAX : (size_t) limit);
+}
+
 /*
  * Return the given text extents.
  * TODO: Support for:
@@ -2053,22 +3159,15 @@ Context2d::setFontFromState() {
 
 NAN_METHOD(Context2d::MeasureText) {
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
-  cairo_t *ctx = context->context();
 
   String::Utf8Value str(info[0]->ToString());
   Local<Object> obj = Nan::New<Object>();
 
 #if HAVE_PANGO
 
-  PangoRectangle ink_rect, logical_rect;
-  PangoFontMetrics *metrics;
-  PangoLayout *layout = context->layout();
-
-  pango_layout_set_text(layout, *str, -1);
-  pango_cairo_update_layout(ctx, layout);
-
-  pango_layout_get_pixel_extents(layout, &ink_rect, &logical_rect);
-  metrics = PANGO_LAYOUT_GET_METRICS(layout);
+  text_layout_t *text = text_layout_lookup(context, *str);
+  PangoRectangle ink_rect = text->ink_rect
+    , logical_rect = text->logical_rect;
 
   double x_offset;
   switch (context->state->textAlignment) {
@@ -2085,13 +3184,13 @@ NAN_METHOD(Context2d::MeasureText) {
   double y_offset;
   switch (context->state->textBaseline) {
     case TEXT_BASELINE_ALPHABETIC:
-      y_offset = -pango_font_metrics_get_ascent(metrics) / PANGO_SCALE;
+      y_offset = -text->ascent / PANGO_SCALE;
       break;
     case TEXT_BASELINE_MIDDLE:
-      y_offset = -(pango_font_metrics_get_ascent(metrics) + pango_font_metrics_get_descent(metrics))/(2.0 * PANGO_SCALE);
+      y_offset = -(text->ascent + text->descent)/(2.0 * PANGO_SCALE);
       break;
     case TEXT_BASELINE_BOTTOM:
-      y_offset = -(pango_font_metrics_get_ascent(metrics) + pango_font_metrics_get_descent(metrics)) / PANGO_SCALE;
+      y_offset = -(text->ascent + text->descent) / PANGO_SCALE;
       break;
     default:
       y_offset = 0.0;
@@ -2112,13 +3211,12 @@ NAN_METHOD(Context2d::MeasureText) {
   obj->Set(Nan::New<String>("emHeightDescent").ToLocalChecked(),
            Nan::New<Number>(PANGO_DESCENT(logical_rect) + y_offset));
   obj->Set(Nan::New<String>("alphabeticBaseline").ToLocalChecked(),
-           Nan::New<Number>((pango_font_metrics_get_ascent(metrics) / PANGO_SCALE)
+           Nan::New<Number>((text->ascent / PANGO_SCALE)
                        + y_offset));
 
-  pango_font_metrics_unref(metrics);
-
 #else
 
+  cairo_t *ctx = context->context();
   cairo_text_extents_t te;
   cairo_font_extents_t fe;
 
@@ -2275,6 +3373,7 @@ NAN_METHOD(Context2d::FillRect) {
   RECT_ARGS;
   if (0 == width || 0 == height) return;
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  CANVAS_CHECK_ATTACHED(context->canvas());
   cairo_t *ctx = context->context();
   context->savePath();
   cairo_rectangle(ctx, x, y, width, height);
@@ -2290,6 +3389,7 @@ NAN_METHOD(Context2d::StrokeRect) {
   RECT_ARGS;
   if (0 == width && 0 == height) return;
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  CANVAS_CHECK_ATTACHED(context->canvas());
   cairo_t *ctx = context->context();
   context->savePath();
   cairo_rectangle(ctx, x, y, width, height);
@@ -2305,11 +3405,13 @@ NAN_METHOD(Context2d::ClearRect) {
   RECT_ARGS;
   if (0 == width || 0 == height) return;
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
+  CANVAS_CHECK_ATTACHED(context->canvas());
   cairo_t *ctx = context->context();
   cairo_save(ctx);
   context->savePath();
   cairo_rectangle(ctx, x, y, width, height);
   cairo_set_operator(ctx, CAIRO_OPERATOR_CLEAR);
+  context->damagePath(false);
   cairo_fill(ctx);
   context->restorePath();
   cairo_restore(ctx);
@@ -2322,16 +3424,7 @@ NAN_METHOD(Context2d::ClearRect) {
 NAN_METHOD(Context2d::Rect) {
   RECT_ARGS;
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
-  cairo_t *ctx = context->context();
-  if (width == 0) {
-    cairo_move_to(ctx, x, y);
-    cairo_line_to(ctx, x, y + height);
-  } else if (height == 0) {
-    cairo_move_to(ctx, x, y);
-    cairo_line_to(ctx, x + width, y);
-  } else {
-    cairo_rectangle(ctx, x, y, width, height);
-  }
+  canvas_rect(context->context(), x, y, width, height);
 }
 
 /*
@@ -2345,26 +3438,14 @@ NAN_METHOD(Context2d::Arc) {
     || !info[3]->IsNumber()
     || !info[4]->IsNumber()) return;
 
-  bool anticlockwise = info[5]->BooleanValue();
-
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
-  cairo_t *ctx = context->context();
-
-  if (anticlockwise && M_PI * 2 != info[4]->NumberValue()) {
-    cairo_arc_negative(ctx
-      , info[0]->NumberValue()
-      , info[1]->NumberValue()
-      , info[2]->NumberValue()
-      , info[3]->NumberValue()
-      , info[4]->NumberValue());
-  } else {
-    cairo_arc(ctx
-      , info[0]->NumberValue()
-      , info[1]->NumberValue()
-      , info[2]->NumberValue()
-      , info[3]->NumberValue()
-      , info[4]->NumberValue());
-  }
+  canvas_arc(context->context()
+    , info[0]->NumberValue()
+    , info[1]->NumberValue()
+    , info[2]->NumberValue()
+    , info[3]->NumberValue()
+    , info[4]->NumberValue()
+    , info[5]->BooleanValue());
 }
 
 /*
@@ -2381,95 +3462,10 @@ NAN_METHOD(Context2d::ArcTo) {
     || !info[4]->IsNumber()) return;
 
   Context2d *context = Nan::ObjectWrap::Unwrap<Context2d>(info.This());
-  cairo_t *ctx = context->context();
-
-  // Current path point
-  double x, y;
-  cairo_get_current_point(ctx, &x, &y);
-  Point<float> p0(x, y);
-
-  // Point (x0,y0)
-  Point<float> p1(info[0]->NumberValue(), info[1]->NumberValue());
-
-  // Point (x1,y1)
-  Point<float> p2(info[2]->NumberValue(), info[3]->NumberValue());
-
-  float radius = info[4]->NumberValue();
-
-  if ((p1.x == p0.x && p1.y == p0.y)
-    || (p1.x == p2.x && p1.y == p2.y)
-    || radius == 0.f) {
-    cairo_line_to(ctx, p1.x, p1.y);
-    return;
-  }
-
-  Point<float> p1p0((p0.x - p1.x),(p0.y - p1.y));
-  Point<float> p1p2((p2.x - p1.x),(p2.y - p1.y));
-  float p1p0_length = sqrtf(p1p0.x * p1p0.x + p1p0.y * p1p0.y);
-  float p1p2_length = sqrtf(p1p2.x * p1p2.x + p1p2.y * p1p2.y);
-
-  double cos_phi = (p1p0.x * p1p2.x + p1p0.y * p1p2.y) / (p1p0_length * p1p2_length);
-  // all points on a line logic
-  if (-1 == cos_phi) {
-    cairo_line_to(ctx, p1.x, p1.y);
-    return;
-  }
-
-  if (1 == cos_phi) {
-    // add infinite far away point
-    unsigned int max_length = 65535;
-    double factor_max = max_length / p1p0_length;
-    Point<float> ep((p0.x + factor_max * p1p0.x), (p0.y + factor_max * p1p0.y));
-    cairo_line_to(ctx, ep.x, ep.y);
-    return;
-  }
-
-  float tangent = radius / tan(acos(cos_phi) / 2);
-  float factor_p1p0 = tangent / p1p0_length;
-  Point<float> t_p1p0((p1.x + factor_p1p0 * p1p0.x), (p1.y + factor_p1p0 * p1p0.y));
-
-  Point<float> orth_p1p0(p1p0.y, -p1p0.x);
-  float orth_p1p0_length = sqrt(orth_p1p0.x * orth_p1p0.x + orth_p1p0.y * orth_p1p0.y);
-  float factor_ra = radius / orth_p1p0_length;
-
-  double cos_alpha = (orth_p1p0.x * p1p2.x + orth_p1p0.y * p1p2.y) / (orth_p1p0_length * p1p2_length);
-  if (cos_alpha < 0.f)
-      orth_p1p0 = Point<float>(-orth_p1p0.x, -orth_p1p0.y);
-
-  Point<float> p((t_p1p0.x + factor_ra * orth_p1p0.x), (t_p1p0.y + factor_ra * orth_p1p0.y));
-
-  orth_p1p0 = Point<float>(-orth_p1p0.x, -orth_p1p0.y);
-  float sa = acos(orth_p1p0.x / orth_p1p0_length);
-  if (orth_p1p0.y < 0.f)
-      sa = 2 * M_PI - sa;
-
-  bool anticlockwise = false;
-
-  float factor_p1p2 = tangent / p1p2_length;
-  Point<float> t_p1p2((p1.x + factor_p1p2 * p1p2.x), (p1.y + factor_p1p2 * p1p2.y));
-  Point<float> orth_p1p2((t_p1p2.x - p.x),(t_p1p2.y - p.y));
-  float orth_p1p2_length = sqrtf(orth_p1p2.x * orth_p1p2.x + orth_p1p2.y * orth_p1p2.y);
-  float ea = acos(orth_p1p2.x / orth_p1p2_length);
-
-  if (orth_p1p2.y < 0) ea = 2 * M_PI - ea;
-  if ((sa > ea) && ((sa - ea) < M_PI)) anticlockwise = true;
-  if ((sa < ea) && ((ea - sa) > M_PI)) anticlockwise = true;
-
-  cairo_line_to(ctx, t_p1p0.x, t_p1p0.y);
-
-  if (anticlockwise && M_PI * 2 != radius) {
-    cairo_arc_negative(ctx
-      , p.x
-      , p.y
-      , radius
-      , sa
-      , ea);
-  } else {
-    cairo_arc(ctx
-      , p.x
-      , p.y
-      , radius
-      , sa
-      , ea);
-  }
+  canvas_arc_to(context->context()
+    , info[0]->NumberValue()
+    , info[1]->NumberValue()
+    , info[2]->NumberValue()
+    , info[3]->NumberValue()
+    , info[4]->NumberValue());
 }
@@ -26,6 +26,38 @@ typedef enum {
   TEXT_DRAW_GLYPHS
 } canvas_draw_mode_t;
 
+typedef enum {
+  SMOOTHING_QUALITY_LOW,
+  SMOOTHING_QUALITY_MEDIUM,
+  SMOOTHING_QUALITY_HIGH
+} canvas_smoothing_quality_t;
+
+#if HAVE_PANGO
+
+/*
+ * Interned, refcounted font family name shared between states.
+ */
+
+typedef struct {
+  unsigned refs;
+  char *name;
+} canvas_font_family_t;
+
+canvas_font_family_t *font_family_intern(const char *name);
+void font_family_retain(canvas_font_family_t *family);
+void font_family_release(canvas_font_family_t *family);
+
+/*
+ * Free the font descriptions and then the font families interned by
+ * the calling thread. Families still held become invalid, so this is
+ * only for threads that are done rendering.
+ */
+
+void font_description_cache_clear();
+void font_family_clear();
+
+#endif
+
 /*
  * State struct.
  *
@@ -37,6 +69,7 @@ typedef struct {
   rgba_t fill;
   rgba_t stroke;
   cairo_filter_t patternQuality;
+  canvas_smoothing_quality_t imageSmoothingQuality;
   cairo_pattern_t *fillPattern;
   cairo_pattern_t *strokePattern;
   cairo_pattern_t *fillGradient;
@@ -49,12 +82,13 @@ typedef struct {
   double shadowOffsetX;
   double shadowOffsetY;
   canvas_draw_mode_t textDrawingMode;
+  bool hasClip;
 
 #if HAVE_PANGO
   PangoWeight fontWeight;
   PangoStyle fontStyle;
   double fontSize;
-  char *fontFamily;
+  canvas_font_family_t *fontFamily;
 #endif
 
 } canvas_state_t;
@@ -65,11 +99,11 @@ void state_assign_fontFamily(canvas_state_t *state, const char *str);
 
 class Context2d: public Nan::ObjectWrap {
   public:
-    short stateno;
-    canvas_state_t *states[CANVAS_MAX_STATES];
+    int stateno;
+    vector<canvas_state_t> states;
     canvas_state_t *state;
     Context2d(Canvas *canvas);
-    static Nan::Persistent<FunctionTemplate> constructor;
+    static IsolatePersistent<FunctionTemplate> constructor;
     static void Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target);
     static NAN_METHOD(New);
     static NAN_METHOD(DrawImage);
@@ -90,6 +124,8 @@ class Context2d: public Nan::ObjectWrap {
     static NAN_METHOD(Stroke);
     static NAN_METHOD(FillText);
     static NAN_METHOD(StrokeText);
+    static NAN_METHOD(FillTextBatch);
+    static NAN_METHOD(MeasureTextBatch);
     static NAN_METHOD(SetFont);
 #ifdef HAVE_FREETYPE
     static NAN_METHOD(SetFontFace);
@@ -107,6 +143,9 @@ class Context2d: public Nan::ObjectWrap {
     static NAN_METHOD(QuadraticCurveTo);
     static NAN_METHOD(LineTo);
     static NAN_METHOD(MoveTo);
+    static NAN_METHOD(Polyline);
+    static NAN_METHOD(Polygons);
+    static NAN_METHOD(Execute);
     static NAN_METHOD(FillRect);
     static NAN_METHOD(StrokeRect);
     static NAN_METHOD(ClearRect);
@@ -114,7 +153,12 @@ class Context2d: public Nan::ObjectWrap {
     static NAN_METHOD(Arc);
     static NAN_METHOD(ArcTo);
     static NAN_METHOD(GetImageData);
+    static NAN_METHOD(FontCacheStats);
+    static NAN_METHOD(TextLayoutCacheStats);
+    static NAN_METHOD(ShadowCacheStats);
+    static NAN_METHOD(SetShadowCacheLimit);
     static NAN_GETTER(GetPatternQuality);
+    static NAN_GETTER(GetImageSmoothingQuality);
     static NAN_GETTER(GetGlobalCompositeOperation);
     static NAN_GETTER(GetGlobalAlpha);
     static NAN_GETTER(GetShadowColor);
@@ -132,6 +176,7 @@ class Context2d: public Nan::ObjectWrap {
     static NAN_GETTER(GetTextDrawingMode);
     static NAN_GETTER(GetFilter);
     static NAN_SETTER(SetPatternQuality);
+    static NAN_SETTER(SetImageSmoothingQuality);
     static NAN_SETTER(SetGlobalCompositeOperation);
     static NAN_SETTER(SetGlobalAlpha);
     static NAN_SETTER(SetShadowColor);
@@ -146,8 +191,13 @@ class Context2d: public Nan::ObjectWrap {
     static NAN_SETTER(SetAntiAlias);
     static NAN_SETTER(SetTextDrawingMode);
     static NAN_SETTER(SetFilter);
-    inline void setContext(cairo_t *ctx) { _context = ctx; }
-    inline cairo_t *context(){ return _context; }
+    inline cairo_t *context(){
+      if (_canvas->tiled) retarget();
+      else if (!_context) createContext();
+      return _context;
+    }
+    cairo_t *measureContext();
+    void resetContext();
     inline Canvas *canvas(){ return _canvas; }
     inline bool hasShadow();
     void inline setSourceRGBA(rgba_t color);
@@ -164,6 +214,8 @@ class Context2d: public Nan::ObjectWrap {
     void inline setFillRule(v8::Local<v8::Value> value);
     void fill(bool preserve = false);
     void stroke(bool preserve = false);
+    void damage(double x1, double y1, double x2, double y2);
+    void damagePath(bool stroking);
     void save();
     void restore();
 
@@ -174,11 +226,20 @@ class Context2d: public Nan::ObjectWrap {
 
   private:
     ~Context2d();
+    void createContext();
+    void retarget();
+    void moveContext(cairo_rectangle_list_t *clip);
     Canvas *_canvas;
     cairo_t *_context;
+    cairo_t *_measure;
     cairo_path_t *_path;
 #if HAVE_PANGO
     PangoLayout *_layout;
+    // font last applied to _layout
+    canvas_font_family_t *_layoutFontFamily;
+    double _layoutFontSize;
+    PangoStyle _layoutFontStyle;
+    PangoWeight _layoutFontWeight;
 #endif
 };
 
@@ -6,9 +6,10 @@
 
 #include "FontFace.h"
 
+#include <uv.h>
 #include <fontconfig/fontconfig.h>
 
-Nan::Persistent<FunctionTemplate> FontFace::constructor;
+IsolatePersistent<FunctionTemplate> FontFace::constructor;
 
 /*
  * Destroy ft_face.
@@ -48,6 +49,27 @@ FT_Library library; /* handle to library */
 bool FontFace::_initLibrary = true;
 static cairo_user_data_key_t key;
 
+/*
+ * FreeType faces share the library, which isn't thread safe, so
+ * faces are created and released under a lock when workers load
+ * fonts too.
+ */
+
+static uv_once_t library_once = UV_ONCE_INIT;
+static uv_mutex_t library_mutex;
+
+static void
+init_library_mutex() {
+  uv_mutex_init(&library_mutex);
+}
+
+static void
+done_face(void *ftFace) {
+  uv_mutex_lock(&library_mutex);
+  FT_Done_Face((FT_Face) ftFace);
+  uv_mutex_unlock(&library_mutex);
+}
+
 /*
  * Initialize a new FontFace.
  */
@@ -69,17 +91,22 @@ NAN_METHOD(FontFace::New) {
   FT_Error ftError;
   cairo_font_face_t *crFace;
 
+  uv_once(&library_once, init_library_mutex);
+  uv_mutex_lock(&library_mutex);
+
   if (_initLibrary) {
-    _initLibrary = false;
     ftError = FT_Init_FreeType(&library);
     if (ftError) {
+      uv_mutex_unlock(&library_mutex);
       return Nan::ThrowError("Could not load library");
     }
+    _initLibrary = false;
   }
 
   // Create new freetype font face.
   ftError = FT_New_Face(library, *filePath, faceIdx, &ftFace);
   if (ftError) {
+    uv_mutex_unlock(&library_mutex);
     return Nan::ThrowError("Could not load font file");
   }
 
@@ -87,19 +114,23 @@ NAN_METHOD(FontFace::New) {
     // Load the font file in fontconfig
     FcBool ok = FcConfigAppFontAddFile(FcConfigGetCurrent(), (FcChar8 *)(*filePath));
     if (!ok) {
+      FT_Done_Face(ftFace);
+      uv_mutex_unlock(&library_mutex);
       return Nan::ThrowError("Could not load font in FontConfig");
     }
   #endif
 
+  uv_mutex_unlock(&library_mutex);
+
   // Create new cairo font face.
   crFace = cairo_ft_font_face_create_for_ft_face(ftFace, 0);
 
   // If the cairo font face is released, release the FreeType font face as well.
   int status = cairo_font_face_set_user_data (crFace, &key,
-                                 ftFace, (cairo_destroy_func_t) FT_Done_Face);
+                                 ftFace, done_face);
   if (status) {
     cairo_font_face_destroy (crFace);
-    FT_Done_Face (ftFace);
+    done_face (ftFace);
     return Nan::ThrowError("Failed to setup cairo font face user data");
   }
 
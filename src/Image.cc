@@ -6,9 +6,11 @@
 
 #include "Canvas.h"
 #include "Image.h"
+#include "mipmap.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <algorithm>
 #include <node_buffer.h>
 
 #ifdef HAVE_GIF
@@ -28,7 +30,7 @@ typedef struct {
   uint8_t *buf;
 } read_closure_t;
 
-Nan::Persistent<FunctionTemplate> Image::constructor;
+IsolatePersistent<FunctionTemplate> Image::constructor;
 
 /*
  * Initialize Image.
@@ -140,6 +142,12 @@ NAN_GETTER(Image::GetSource) {
 
 void
 Image::clearData() {
+  for (size_t i = 0; i < _mips.size(); ++i)
+    cairo_surface_destroy(_mips[i]);
+  _mips.clear();
+  Nan::AdjustExternalMemory(-_mips_len);
+  _mips_len = 0;
+
   if (_surface) {
     cairo_surface_destroy(_surface);
     Nan::AdjustExternalMemory(-_data_len);
@@ -157,6 +165,30 @@ Image::clearData() {
   state = DEFAULT;
 }
 
+/*
+ * Return mip level `level`, the image halved `level` times, or the
+ * smallest level available. Levels are built on first use and kept
+ * until the image changes. Returns NULL when no level can be built.
+ */
+
+cairo_surface_t *
+Image::mip(int level) {
+  if (!_surface || !(data_mode & DATA_IMAGE) || level < 1) return NULL;
+
+  while ((int) _mips.size() < level) {
+    cairo_surface_t *prev = _mips.empty() ? _surface : _mips.back();
+    cairo_surface_t *half = canvas_half_size(prev);
+    if (!half) break;
+    int len = cairo_image_surface_get_stride(half) * cairo_image_surface_get_height(half);
+    Nan::AdjustExternalMemory(len);
+    _mips_len += len;
+    _mips.push_back(half);
+  }
+
+  if (_mips.empty()) return NULL;
+  return _mips[(std::min)((size_t) level, _mips.size()) - 1];
+}
+
 /*
  * Set src path.
  */
@@ -317,6 +349,7 @@ Image::Image() {
   _data = NULL;
   _data_len = 0;
   _surface = NULL;
+  _mips_len = 0;
   width = height = 0;
   state = DEFAULT;
   onload = NULL;
@@ -8,6 +8,7 @@
 #ifndef __NODE_IMAGE_H__
 #define __NODE_IMAGE_H__
 
+#include <vector>
 #include "Canvas.h"
 
 #ifdef HAVE_JPEG
@@ -33,7 +34,7 @@ class Image: public Nan::ObjectWrap {
     int width, height;
     Nan::Callback *onload;
     Nan::Callback *onerror;
-    static Nan::Persistent<FunctionTemplate> constructor;
+    static IsolatePersistent<FunctionTemplate> constructor;
     static void Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target);
     static NAN_METHOD(New);
     static NAN_GETTER(GetSource);
@@ -60,6 +61,7 @@ class Image: public Nan::ObjectWrap {
     cairo_status_t loadPNGFromBuffer(uint8_t *buf);
     cairo_status_t loadPNG();
     void clearData();
+    cairo_surface_t *mip(int level);
 #ifdef HAVE_GIF
     cairo_status_t loadGIFFromBuffer(uint8_t *buf, unsigned len);
     cairo_status_t loadGIF(FILE *stream);
@@ -102,6 +104,8 @@ class Image: public Nan::ObjectWrap {
     cairo_surface_t *_surface;
     uint8_t *_data;
     int _data_len;
+    std::vector<cairo_surface_t *> _mips;
+    int _mips_len;
     ~Image();
 };
 
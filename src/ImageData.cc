@@ -7,7 +7,7 @@
 
 #include "ImageData.h"
 
-Nan::Persistent<FunctionTemplate> ImageData::constructor;
+IsolatePersistent<FunctionTemplate> ImageData::constructor;
 
 /*
  * Initialize ImageData.
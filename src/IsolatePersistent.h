@@ -0,0 +1,93 @@
+//
+// IsolatePersistent.h
+//
+
+#ifndef __NODE_ISOLATE_PERSISTENT_H__
+#define __NODE_ISOLATE_PERSISTENT_H__
+
+#include <map>
+#include <uv.h>
+#include <node.h>
+#include <node_version.h>
+#include <nan.h>
+
+using namespace v8;
+
+/*
+ * A persistent handle per isolate, so that the addon can be loaded by
+ * the main thread and by worker threads at the same time. Handles are
+ * dropped when the isolate's environment is torn down. Each thread
+ * caches the handle of the isolate it runs, so that only setting and
+ * dropping handles takes the lock.
+ */
+
+template <typename T>
+class IsolatePersistent {
+  public:
+    IsolatePersistent() { uv_mutex_init(&_mutex); }
+
+    /*
+     * Set the handle of the current isolate.
+     */
+
+    void Reset(Local<T> value) {
+      Isolate *isolate = Isolate::GetCurrent();
+      uv_mutex_lock(&_mutex);
+      Nan::Persistent<T> *&persistent = _handles[isolate];
+      bool added = !persistent;
+      if (added) persistent = new Nan::Persistent<T>();
+      persistent->Reset(value);
+      uv_mutex_unlock(&_mutex);
+      _cache[this] = cached_t(isolate, persistent);
+#if NODE_MODULE_VERSION >= 64
+      if (added) node::AddEnvironmentCleanupHook(isolate, Forget, new hook_t(this, isolate));
+#endif
+    }
+
+    /*
+     * Return the handle of the current isolate.
+     */
+
+    Local<T> Get() {
+      Isolate *isolate = Isolate::GetCurrent();
+      cached_t &cached = _cache[this];
+      if (cached.first != isolate) {
+        // First use by this thread, or by another isolate on it
+        uv_mutex_lock(&_mutex);
+        typename handles_t::iterator it = _handles.find(isolate);
+        cached = cached_t(isolate, it == _handles.end() ? NULL : it->second);
+        uv_mutex_unlock(&_mutex);
+      }
+      return cached.second ? Nan::New(*cached.second) : Local<T>();
+    }
+
+  private:
+    typedef std::map<Isolate *, Nan::Persistent<T> *> handles_t;
+    typedef std::pair<IsolatePersistent<T> *, Isolate *> hook_t;
+    typedef std::pair<Isolate *, Nan::Persistent<T> *> cached_t;
+    typedef std::map<IsolatePersistent<T> *, cached_t> cache_t;
+
+    static void Forget(void *arg) {
+      hook_t *hook = (hook_t *) arg;
+      IsolatePersistent<T> *self = hook->first;
+      uv_mutex_lock(&self->_mutex);
+      typename handles_t::iterator it = self->_handles.find(hook->second);
+      Nan::Persistent<T> *persistent = it->second;
+      self->_handles.erase(it);
+      uv_mutex_unlock(&self->_mutex);
+      // Environments are torn down on the thread that runs them
+      _cache.erase(self);
+      persistent->Reset();
+      delete persistent;
+      delete hook;
+    }
+
+    handles_t _handles;
+    uv_mutex_t _mutex;
+    static thread_local cache_t _cache;
+};
+
+template <typename T>
+thread_local typename IsolatePersistent<T>::cache_t IsolatePersistent<T>::_cache;
+
+#endif /* __NODE_ISOLATE_PERSISTENT_H__ */
@@ -7,6 +7,7 @@
 #define __NODE_JPEG_STREAM_H__
 
 #include "Canvas.h"
+#include <setjmp.h>
 #include <jpeglib.h>
 #include <jerror.h>
 
@@ -120,10 +121,12 @@ write_to_jpeg_stream(cairo_surface_t *surface, int bufsize, int quality, bool pr
 
   jpeg_start_compress(&cinfo, TRUE);
   unsigned char *dst;
-  unsigned int *src = (unsigned int *) cairo_image_surface_get_data(surface);
+  unsigned char *data = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface);
   int sl = 0;
   dst = (unsigned char *) malloc(w * 3);
   while (sl < h) {
+    unsigned int *src = (unsigned int *) (data + sl * stride);
     unsigned char *dp = dst;
     int x = 0;
     while (x < w) {
@@ -143,4 +146,235 @@ write_to_jpeg_stream(cairo_surface_t *surface, int bufsize, int quality, bool pr
   jpeg_destroy_compress(&cinfo);
 }
 
+/*
+ * Error manager which longjmps back to the encoder
+ * instead of letting libjpeg exit() the process.
+ */
+
+typedef struct {
+  struct jpeg_error_mgr pub;
+  jmp_buf jmp;
+} canvas_jpeg_error_mgr;
+
+void
+canvas_jpeg_error_exit(j_common_ptr cinfo){
+  canvas_jpeg_error_mgr *err = (canvas_jpeg_error_mgr *) cinfo->err;
+  longjmp(err->jmp, 1);
+}
+
+/*
+ * Destination writing straight into the closure's growable buffer.
+ * Once the output passes `limit` bytes the pass is abandoned.
+ */
+
+typedef struct {
+  struct jpeg_destination_mgr pub;
+  closure_t *closure;
+  unsigned limit;
+} buffer_destination_mgr;
+
+void
+init_buffer_destination(j_compress_ptr cinfo){
+  buffer_destination_mgr *dest = (buffer_destination_mgr *) cinfo->dest;
+  dest->closure->len = 0;
+  dest->pub.next_output_byte = dest->closure->data;
+  dest->pub.free_in_buffer = dest->closure->max_len;
+}
+
+boolean
+empty_buffer_output(j_compress_ptr cinfo){
+  buffer_destination_mgr *dest = (buffer_destination_mgr *) cinfo->dest;
+  closure_t *closure = dest->closure;
+  unsigned len = closure->max_len;
+
+  // already over budget, no point in finishing this pass
+  if (dest->limit && len > dest->limit)
+    longjmp(((canvas_jpeg_error_mgr *) cinfo->err)->jmp, 2);
+
+  uint8_t *data = (uint8_t *) realloc(closure->data, len * 2);
+  if (!data) ERREXIT(cinfo, JERR_OUT_OF_MEMORY);
+  closure->data = data;
+  closure->max_len = len * 2;
+
+  dest->pub.next_output_byte = data + len;
+  dest->pub.free_in_buffer = len;
+  return true;
+}
+
+void
+term_buffer_destination(j_compress_ptr cinfo){
+  buffer_destination_mgr *dest = (buffer_destination_mgr *) cinfo->dest;
+  dest->closure->len = dest->closure->max_len - dest->pub.free_in_buffer;
+}
+
+void
+jpeg_buffer_dest(j_compress_ptr cinfo){
+  if (cinfo->dest == NULL) {
+    cinfo->dest = (struct jpeg_destination_mgr *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+         sizeof(buffer_destination_mgr));
+  }
+
+  cinfo->dest->init_destination = &init_buffer_destination;
+  cinfo->dest->empty_output_buffer = &empty_buffer_output;
+  cinfo->dest->term_destination = &term_buffer_destination;
+}
+
+/*
+ * Compress the YCbCr `rows` at `quality` into `closure`. Returns 1 when
+ * the output fits within `limit` bytes (0 meaning no limit), 0 when it
+ * does not and -1 when libjpeg fails.
+ */
+
+int
+encode_jpeg_quality(j_compress_ptr cinfo, JSAMPARRAY rows, int quality, bool progressive, unsigned limit, closure_t *closure){
+  canvas_jpeg_error_mgr *err = (canvas_jpeg_error_mgr *) cinfo->err;
+  buffer_destination_mgr *dest = (buffer_destination_mgr *) cinfo->dest;
+
+  int jumped = setjmp(err->jmp);
+  if (jumped) {
+    jpeg_abort_compress(cinfo);
+    return 2 == jumped ? 0 : -1;
+  }
+
+  dest->closure = closure;
+  dest->limit = limit;
+
+  // input is already YCbCr, so libjpeg skips color conversion
+  cinfo->in_color_space = JCS_YCbCr;
+  cinfo->input_components = 3;
+  jpeg_set_defaults(cinfo);
+  if (progressive)
+     jpeg_simple_progression(cinfo);
+  jpeg_set_quality(cinfo, quality, (quality<25)?0:1);
+
+  jpeg_start_compress(cinfo, TRUE);
+  while (cinfo->next_scanline < cinfo->image_height) {
+    jpeg_write_scanlines(cinfo
+      , rows + cinfo->next_scanline
+      , cinfo->image_height - cinfo->next_scanline);
+  }
+  jpeg_finish_compress(cinfo);
+
+  return !limit || closure->len <= limit;
+}
+
+/*
+ * Swap the output buffers of two closures.
+ */
+
+void
+swap_closure_data(closure_t *a, closure_t *b){
+  uint8_t *data = a->data;
+  unsigned len = a->len;
+  unsigned max_len = a->max_len;
+  a->data = b->data;
+  a->len = b->len;
+  a->max_len = b->max_len;
+  b->data = data;
+  b->len = len;
+  b->max_len = max_len;
+}
+
+/*
+ * Fixed point JFIF RGB -> YCbCr coefficients.
+ */
+
+#define YCC_FIX(x) ((int) ((x) * 65536 + 0.5))
+
+/*
+ * Encode `surface` as JPEG into `closure`. The surface is converted to
+ * YCbCr once, then when `closure->max_bytes` is set the quality is binary
+ * searched (with `closure->quality` as the ceiling) for the best result
+ * fitting the budget. The chosen quality is stored back into
+ * `closure->quality`, or 0 when even quality 1 is too large.
+ */
+
+cairo_status_t
+write_to_jpeg_buffer(cairo_surface_t *surface, closure_t *closure){
+  int w = cairo_image_surface_get_width(surface);
+  int h = cairo_image_surface_get_height(surface);
+  int stride = cairo_image_surface_get_stride(surface);
+  uint8_t *data = cairo_image_surface_get_data(surface);
+
+  if (!data) return CAIRO_STATUS_SURFACE_TYPE_MISMATCH;
+  if (!w || !h) return CAIRO_STATUS_INVALID_SIZE;
+
+  uint8_t *ycc = (uint8_t *) malloc(w * h * 3);
+  JSAMPROW *rows = (JSAMPROW *) malloc(h * sizeof(JSAMPROW));
+  if (!ycc || !rows) {
+    free(ycc);
+    free(rows);
+    return CAIRO_STATUS_NO_MEMORY;
+  }
+
+  cairo_surface_flush(surface);
+  for (int y = 0; y < h; ++y) {
+    uint32_t *src = (uint32_t *) (data + y * stride);
+    uint8_t *dst = rows[y] = ycc + y * w * 3;
+    for (int x = 0; x < w; ++x) {
+      int r = (src[x] >> 16) & 255
+        , g = (src[x] >> 8) & 255
+        , b = src[x] & 255;
+      dst[0] = (YCC_FIX(0.29900) * r + YCC_FIX(0.58700) * g + YCC_FIX(0.11400) * b + 32768) >> 16;
+      dst[1] = (-YCC_FIX(0.16874) * r - YCC_FIX(0.33126) * g + YCC_FIX(0.50000) * b + (128 << 16) + 32767) >> 16;
+      dst[2] = (YCC_FIX(0.50000) * r - YCC_FIX(0.41869) * g - YCC_FIX(0.08131) * b + (128 << 16) + 32767) >> 16;
+      dst += 3;
+    }
+  }
+
+  closure_t probe;
+  cairo_status_t status = closure_init(&probe, closure->canvas, 0, PNG_NO_FILTERS);
+  if (status) {
+    free(ycc);
+    free(rows);
+    return status;
+  }
+
+  struct jpeg_compress_struct cinfo;
+  canvas_jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = canvas_jpeg_error_exit;
+  jpeg_create_compress(&cinfo);
+  cinfo.image_width = w;
+  cinfo.image_height = h;
+  jpeg_buffer_dest(&cinfo);
+
+  int lo = 1
+    , hi = closure->quality
+    , best = 0
+    , res = encode_jpeg_quality(&cinfo, rows, hi, closure->progressive, closure->max_bytes, closure);
+
+  if (res > 0) {
+    best = hi;
+  } else if (0 == res) {
+    // binary search the highest quality that fits
+    --hi;
+    while (lo <= hi) {
+      int mid = (lo + hi) / 2;
+      res = encode_jpeg_quality(&cinfo, rows, mid, closure->progressive, closure->max_bytes, &probe);
+      if (res < 0) break;
+      if (res) {
+        best = mid;
+        swap_closure_data(closure, &probe);
+        lo = mid + 1;
+      } else {
+        hi = mid - 1;
+      }
+    }
+  }
+
+  jpeg_destroy_compress(&cinfo);
+  // may run on a worker thread, so no external memory hint here
+  free(probe.data);
+  free(ycc);
+  free(rows);
+
+  if (res < 0) return CAIRO_STATUS_WRITE_ERROR;
+  closure->quality = best;
+  return CAIRO_STATUS_SUCCESS;
+}
+
+#undef YCC_FIX
+
 #endif
@@ -0,0 +1,752 @@
+//
+// Path2D.cc
+//
+
+#include <math.h>
+#include <cmath>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Point.h"
+#include "Path2D.h"
+
+// Windows doesn't support the C99 names for these
+#ifdef _MSC_VER
+#define isfinite(x) _finite(x)
+#endif
+
+#ifndef isfinite
+#define isfinite(x) std::isfinite(x)
+#endif
+
+IsolatePersistent<FunctionTemplate> Path2D::constructor;
+
+/*
+ * Adds an arc at x, y with the given radius and start/end angles.
+ */
+
+void
+canvas_arc(cairo_t *ctx, double x, double y, double radius, double sa, double ea, bool anticlockwise) {
+  if (anticlockwise && M_PI * 2 != ea) {
+    cairo_arc_negative(ctx, x, y, radius, sa, ea);
+  } else {
+    cairo_arc(ctx, x, y, radius, sa, ea);
+  }
+}
+
+/*
+ * Adds an arcTo point (x0,y0) to (x1,y1) with the given radius.
+ *
+ * Implementation influenced by WebKit.
+ */
+
+void
+canvas_arc_to(cairo_t *ctx, double x1, double y1, double x2, double y2, double r) {
+  // Current path point
+  double x, y;
+  cairo_get_current_point(ctx, &x, &y);
+  Point<float> p0(x, y);
+
+  // Point (x0,y0)
+  Point<float> p1(x1, y1);
+
+  // Point (x1,y1)
+  Point<float> p2(x2, y2);
+
+  float radius = r;
+
+  if ((p1.x == p0.x && p1.y == p0.y)
+    || (p1.x == p2.x && p1.y == p2.y)
+    || radius == 0.f) {
+    cairo_line_to(ctx, p1.x, p1.y);
+    return;
+  }
+
+  Point<float> p1p0((p0.x - p1.x),(p0.y - p1.y));
+  Point<float> p1p2((p2.x - p1.x),(p2.y - p1.y));
+  float p1p0_length = sqrtf(p1p0.x * p1p0.x + p1p0.y * p1p0.y);
+  float p1p2_length = sqrtf(p1p2.x * p1p2.x + p1p2.y * p1p2.y);
+
+  double cos_phi = (p1p0.x * p1p2.x + p1p0.y * p1p2.y) / (p1p0_length * p1p2_length);
+  // all points on a line logic
+  if (-1 == cos_phi) {
+    cairo_line_to(ctx, p1.x, p1.y);
+    return;
+  }
+
+  if (1 == cos_phi) {
+    // add infinite far away point
+    unsigned int max_length = 65535;
+    double factor_max = max_length / p1p0_length;
+    Point<float> ep((p0.x + factor_max * p1p0.x), (p0.y + factor_max * p1p0.y));
+    cairo_line_to(ctx, ep.x, ep.y);
+    return;
+  }
+
+  float tangent = radius / tan(acos(cos_phi) / 2);
+  float factor_p1p0 = tangent / p1p0_length;
+  Point<float> t_p1p0((p1.x + factor_p1p0 * p1p0.x), (p1.y + factor_p1p0 * p1p0.y));
+
+  Point<float> orth_p1p0(p1p0.y, -p1p0.x);
+  float orth_p1p0_length = sqrt(orth_p1p0.x * orth_p1p0.x + orth_p1p0.y * orth_p1p0.y);
+  float factor_ra = radius / orth_p1p0_length;
+
+  double cos_alpha = (orth_p1p0.x * p1p2.x + orth_p1p0.y * p1p2.y) / (orth_p1p0_length * p1p2_length);
+  if (cos_alpha < 0.f)
+      orth_p1p0 = Point<float>(-orth_p1p0.x, -orth_p1p0.y);
+
+  Point<float> p((t_p1p0.x + factor_ra * orth_p1p0.x), (t_p1p0.y + factor_ra * orth_p1p0.y));
+
+  orth_p1p0 = Point<float>(-orth_p1p0.x, -orth_p1p0.y);
+  float sa = acos(orth_p1p0.x / orth_p1p0_length);
+  if (orth_p1p0.y < 0.f)
+      sa = 2 * M_PI - sa;
+
+  bool anticlockwise = false;
+
+  float factor_p1p2 = tangent / p1p2_length;
+  Point<float> t_p1p2((p1.x + factor_p1p2 * p1p2.x), (p1.y + factor_p1p2 * p1p2.y));
+  Point<float> orth_p1p2((t_p1p2.x - p.x),(t_p1p2.y - p.y));
+  float orth_p1p2_length = sqrtf(orth_p1p2.x * orth_p1p2.x + orth_p1p2.y * orth_p1p2.y);
+  float ea = acos(orth_p1p2.x / orth_p1p2_length);
+
+  if (orth_p1p2.y < 0) ea = 2 * M_PI - ea;
+  if ((sa > ea) && ((sa - ea) < M_PI)) anticlockwise = true;
+  if ((sa < ea) && ((ea - sa) > M_PI)) anticlockwise = true;
+
+  cairo_line_to(ctx, t_p1p0.x, t_p1p0.y);
+
+  if (anticlockwise && M_PI * 2 != radius) {
+    cairo_arc_negative(ctx
+      , p.x
+      , p.y
+      , radius
+      , sa
+      , ea);
+  } else {
+    cairo_arc(ctx
+      , p.x
+      , p.y
+      , radius
+      , sa
+      , ea);
+  }
+}
+
+/*
+ * Quadratic curve approximation from libsvg-cairo.
+ */
+
+void
+canvas_quadratic_curve_to(cairo_t *ctx, double x1, double y1, double x2, double y2) {
+  double x, y;
+  cairo_get_current_point(ctx, &x, &y);
+
+  if (0 == x && 0 == y) {
+    x = x1;
+    y = y1;
+  }
+
+  cairo_curve_to(ctx
+    , x  + 2.0 / 3.0 * (x1 - x),  y  + 2.0 / 3.0 * (y1 - y)
+    , x2 + 2.0 / 3.0 * (x1 - x2), y2 + 2.0 / 3.0 * (y1 - y2)
+    , x2
+    , y2);
+}
+
+/*
+ * Adds a rectangle subpath.
+ */
+
+void
+canvas_rect(cairo_t *ctx, double x, double y, double width, double height) {
+  if (width == 0) {
+    cairo_move_to(ctx, x, y);
+    cairo_line_to(ctx, x, y + height);
+  } else if (height == 0) {
+    cairo_move_to(ctx, x, y);
+    cairo_line_to(ctx, x + width, y);
+  } else {
+    cairo_rectangle(ctx, x, y, width, height);
+  }
+}
+
+/*
+ * Adds a polyline through the `n` points of `xy` (x, y pairs). Non-finite
+ * points break the line into separate subpaths. With `simplify`, points
+ * landing in the same device pixel as the previous point are dropped,
+ * except for the last point of each run.
+ */
+
+void
+canvas_polyline(cairo_t *ctx, const double *xy, size_t n, bool closed, bool simplify) {
+  cairo_matrix_t matrix;
+  cairo_get_matrix(ctx, &matrix);
+
+  bool pen = false;
+  double lx = 0, ly = 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    double x = xy[i * 2]
+      , y = xy[i * 2 + 1];
+
+    if (!isfinite(x) || !isfinite(y)) {
+      pen = false;
+      continue;
+    }
+
+    if (simplify) {
+      double dx = x, dy = y;
+      cairo_matrix_transform_point(&matrix, &dx, &dy);
+      dx = floor(dx);
+      dy = floor(dy);
+      bool last = i + 1 == n
+        || !isfinite(xy[i * 2 + 2])
+        || !isfinite(xy[i * 2 + 3]);
+      if (pen && !last && dx == lx && dy == ly) continue;
+      lx = dx;
+      ly = dy;
+    }
+
+    if (pen) {
+      cairo_line_to(ctx, x, y);
+    } else {
+      cairo_move_to(ctx, x, y);
+      pen = true;
+    }
+  }
+
+  if (closed && pen) cairo_close_path(ctx);
+}
+
+/*
+ * SVG path data tokenizing.
+ */
+
+static const char *
+svg_skip(const char *p) {
+  while (*p && (isspace((unsigned char) *p) || ',' == *p)) ++p;
+  return p;
+}
+
+static bool
+svg_number(const char **s, double *out) {
+  const char *p = svg_skip(*s);
+  const char *start = p;
+  bool digits = false;
+
+  if ('+' == *p || '-' == *p) ++p;
+  while (isdigit((unsigned char) *p)) ++p, digits = true;
+  if ('.' == *p) {
+    ++p;
+    while (isdigit((unsigned char) *p)) ++p, digits = true;
+  }
+  if (!digits) return false;
+  if ('e' == *p || 'E' == *p) {
+    const char *e = p + 1;
+    if ('+' == *e || '-' == *e) ++e;
+    if (isdigit((unsigned char) *e)) {
+      p = e;
+      while (isdigit((unsigned char) *p)) ++p;
+    }
+  }
+
+  char buf[64];
+  size_t len = p - start;
+  if (len >= sizeof(buf)) return false;
+  memcpy(buf, start, len);
+  buf[len] = 0;
+  *out = strtod(buf, NULL);
+  *s = p;
+  return true;
+}
+
+static bool
+svg_flag(const char **s, bool *out) {
+  const char *p = svg_skip(*s);
+  if ('0' != *p && '1' != *p) return false;
+  *out = '1' == *p;
+  *s = p + 1;
+  return true;
+}
+
+/*
+ * Elliptical arc from the current point (x0, y0), converted
+ * from endpoint to center parameterization.
+ */
+
+static void
+svg_arc(cairo_t *ctx, double x0, double y0, double rx, double ry
+  , double rotation, bool large, bool sweep, double x, double y) {
+  if (x0 == x && y0 == y) return;
+  rx = fabs(rx);
+  ry = fabs(ry);
+  if (0 == rx || 0 == ry) {
+    cairo_line_to(ctx, x, y);
+    return;
+  }
+
+  double phi = rotation * M_PI / 180
+    , cosp = cos(phi)
+    , sinp = sin(phi)
+    , dx2 = (x0 - x) / 2
+    , dy2 = (y0 - y) / 2
+    , x1p = cosp * dx2 + sinp * dy2
+    , y1p = -sinp * dx2 + cosp * dy2;
+
+  double lambda = (x1p * x1p) / (rx * rx) + (y1p * y1p) / (ry * ry);
+  if (lambda > 1) {
+    rx *= sqrt(lambda);
+    ry *= sqrt(lambda);
+  }
+
+  double num = rx * rx * ry * ry - rx * rx * y1p * y1p - ry * ry * x1p * x1p
+    , den = rx * rx * y1p * y1p + ry * ry * x1p * x1p
+    , coef = num > 0 ? sqrt(num / den) : 0;
+  if (large == sweep) coef = -coef;
+
+  double cxp = coef * rx * y1p / ry
+    , cyp = coef * -ry * x1p / rx
+    , cx = cosp * cxp - sinp * cyp + (x0 + x) / 2
+    , cy = sinp * cxp + cosp * cyp + (y0 + y) / 2
+    , theta1 = atan2((y1p - cyp) / ry, (x1p - cxp) / rx)
+    , theta2 = atan2((-y1p - cyp) / ry, (-x1p - cxp) / rx)
+    , delta = theta2 - theta1;
+
+  if (sweep && delta < 0) delta += 2 * M_PI;
+  if (!sweep && delta > 0) delta -= 2 * M_PI;
+
+  cairo_save(ctx);
+  cairo_translate(ctx, cx, cy);
+  cairo_rotate(ctx, phi);
+  cairo_scale(ctx, rx, ry);
+  if (sweep) {
+    cairo_arc(ctx, 0, 0, 1, theta1, theta1 + delta);
+  } else {
+    cairo_arc_negative(ctx, 0, 0, 1, theta1, theta1 + delta);
+  }
+  cairo_restore(ctx);
+}
+
+/*
+ * Append SVG path data `d` to `ctx`. As with SVG, segments up
+ * to the first error are kept and the rest is ignored.
+ */
+
+void
+canvas_svg_path(cairo_t *ctx, const char *d) {
+  const char *p = d;
+  char cmd = 0, prev = 0;
+  double cx = 0, cy = 0   // current point
+    , sx = 0, sy = 0      // subpath start
+    , lx = 0, ly = 0;     // last control point
+
+  for (;;) {
+    p = svg_skip(p);
+    if (!*p) return;
+
+    if (isalpha((unsigned char) *p)) {
+      cmd = *p++;
+    } else if (!prev || 'Z' == prev || 'z' == prev) {
+      return;
+    } else {
+      // implicit repeat, moveto continues as lineto
+      cmd = 'M' == prev ? 'L' : 'm' == prev ? 'l' : prev;
+    }
+
+    bool rel = islower(cmd);
+    double ox = rel ? cx : 0
+      , oy = rel ? cy : 0
+      , x1, y1, x2, y2, x, y;
+
+    switch (toupper(cmd)) {
+      case 'M':
+        if (!svg_number(&p, &x) || !svg_number(&p, &y)) return;
+        cairo_move_to(ctx, sx = cx = ox + x, sy = cy = oy + y);
+        break;
+      case 'L':
+        if (!svg_number(&p, &x) || !svg_number(&p, &y)) return;
+        cairo_line_to(ctx, cx = ox + x, cy = oy + y);
+        break;
+      case 'H':
+        if (!svg_number(&p, &x)) return;
+        cairo_line_to(ctx, cx = ox + x, cy);
+        break;
+      case 'V':
+        if (!svg_number(&p, &y)) return;
+        cairo_line_to(ctx, cx, cy = oy + y);
+        break;
+      case 'C':
+        if (!svg_number(&p, &x1) || !svg_number(&p, &y1)
+          || !svg_number(&p, &x2) || !svg_number(&p, &y2)
+          || !svg_number(&p, &x) || !svg_number(&p, &y)) return;
+        cairo_curve_to(ctx, ox + x1, oy + y1, lx = ox + x2, ly = oy + y2, cx = ox + x, cy = oy + y);
+        break;
+      case 'S':
+        if (!svg_number(&p, &x2) || !svg_number(&p, &y2)
+          || !svg_number(&p, &x) || !svg_number(&p, &y)) return;
+        if (prev && strchr("CcSs", prev)) {
+          x1 = 2 * cx - lx;
+          y1 = 2 * cy - ly;
+        } else {
+          x1 = cx;
+          y1 = cy;
+        }
+        cairo_curve_to(ctx, x1, y1, lx = ox + x2, ly = oy + y2, cx = ox + x, cy = oy + y);
+        break;
+      case 'Q':
+        if (!svg_number(&p, &x1) || !svg_number(&p, &y1)
+          || !svg_number(&p, &x) || !svg_number(&p, &y)) return;
+        lx = ox + x1;
+        ly = oy + y1;
+        x = ox + x;
+        y = oy + y;
+        cairo_curve_to(ctx
+          , cx + 2.0 / 3.0 * (lx - cx), cy + 2.0 / 3.0 * (ly - cy)
+          , x + 2.0 / 3.0 * (lx - x), y + 2.0 / 3.0 * (ly - y)
+          , x, y);
+        cx = x;
+        cy = y;
+        break;
+      case 'T':
+        if (!svg_number(&p, &x) || !svg_number(&p, &y)) return;
+        if (prev && strchr("QqTt", prev)) {
+          lx = 2 * cx - lx;
+          ly = 2 * cy - ly;
+        } else {
+          lx = cx;
+          ly = cy;
+        }
+        x = ox + x;
+        y = oy + y;
+        cairo_curve_to(ctx
+          , cx + 2.0 / 3.0 * (lx - cx), cy + 2.0 / 3.0 * (ly - cy)
+          , x + 2.0 / 3.0 * (lx - x), y + 2.0 / 3.0 * (ly - y)
+          , x, y);
+        cx = x;
+        cy = y;
+        break;
+      case 'A': {
+        double rx, ry, rotation;
+        bool large, sweep;
+        if (!svg_number(&p, &rx) || !svg_number(&p, &ry)
+          || !svg_number(&p, &rotation)
+          || !svg_flag(&p, &large) || !svg_flag(&p, &sweep)
+          || !svg_number(&p, &x) || !svg_number(&p, &y)) return;
+        x = ox + x;
+        y = oy + y;
+        svg_arc(ctx, cx, cy, rx, ry, rotation, large, sweep, x, y);
+        cx = x;
+        cy = y;
+        break;
+      }
+      case 'Z':
+        cairo_close_path(ctx);
+        cx = sx;
+        cy = sy;
+        break;
+      default:
+        return;
+    }
+
+    prev = cmd;
+  }
+}
+
+/*
+ * Initialize Path2D.
+ */
+
+void
+Path2D::Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target) {
+  Nan::HandleScope scope;
+
+  // Constructor
+  Local<FunctionTemplate> ctor = Nan::New<FunctionTemplate>(Path2D::New);
+  constructor.Reset(ctor);
+  ctor->InstanceTemplate()->SetInternalFieldCount(1);
+  ctor->SetClassName(Nan::New("Path2D").ToLocalChecked());
+
+  // Prototype
+  Nan::SetPrototypeMethod(ctor, "addPath", AddPath);
+  Nan::SetPrototypeMethod(ctor, "closePath", ClosePath);
+  Nan::SetPrototypeMethod(ctor, "moveTo", MoveTo);
+  Nan::SetPrototypeMethod(ctor, "lineTo", LineTo);
+  Nan::SetPrototypeMethod(ctor, "bezierCurveTo", BezierCurveTo);
+  Nan::SetPrototypeMethod(ctor, "quadraticCurveTo", QuadraticCurveTo);
+  Nan::SetPrototypeMethod(ctor, "arc", Arc);
+  Nan::SetPrototypeMethod(ctor, "arcTo", ArcTo);
+  Nan::SetPrototypeMethod(ctor, "rect", Rect);
+  Nan::Set(target, Nan::New("Path2D").ToLocalChecked(), ctor->GetFunction());
+}
+
+/*
+ * Initialize a new Path2D:
+ *
+ *   new Path2D()
+ *   new Path2D(path)
+ *   new Path2D('M0 0 L10 10 ...')
+ *   new Path2D(Float64Array xy[, closed])
+ */
+
+NAN_METHOD(Path2D::New) {
+  if (!info.IsConstructCall()) {
+    return Nan::ThrowTypeError("Class constructors cannot be invoked without 'new'");
+  }
+
+  Path2D *path = new Path2D;
+
+  if (info[0]->IsString()) {
+    String::Utf8Value d(info[0]);
+    path->push(OP_SVG).svg = *d;
+  } else if (info[0]->IsFloat64Array()) {
+    Nan::TypedArrayContents<double> xy(info[0]);
+    Op &op = path->push(OP_POLYLINE, info[1]->BooleanValue());
+    op.xy.assign(*xy, *xy + xy.length() / 2 * 2);
+  } else if (info[0]->IsObject()
+    && Path2D::constructor.Get()->HasInstance(info[0]->ToObject())) {
+    Path2D *other = Nan::ObjectWrap::Unwrap<Path2D>(info[0]->ToObject());
+    path->_ops = other->_ops;
+  }
+
+  path->Wrap(info.This());
+  info.GetReturnValue().Set(info.This());
+}
+
+/*
+ * Append a segment of the given type.
+ */
+
+Path2D::Op &
+Path2D::push(OpType type, double a, double b, double c, double d, double e, double f) {
+  _ops.push_back(Op());
+  Op &op = _ops.back();
+  op.type = type;
+  op.args[0] = a;
+  op.args[1] = b;
+  op.args[2] = c;
+  op.args[3] = d;
+  op.args[4] = e;
+  op.args[5] = f;
+  return op;
+}
+
+/*
+ * Replay the segments onto `ctx` under its current transform.
+ */
+
+void
+Path2D::append(cairo_t *ctx) {
+  cairo_matrix_t matrix;
+  for (size_t i = 0; i < _ops.size(); ++i) {
+    const Op &op = _ops[i];
+    const double *a = op.args;
+    switch (op.type) {
+      case OP_MOVE_TO:
+        cairo_move_to(ctx, a[0], a[1]);
+        break;
+      case OP_LINE_TO:
+        cairo_line_to(ctx, a[0], a[1]);
+        break;
+      case OP_CURVE_TO:
+        cairo_curve_to(ctx, a[0], a[1], a[2], a[3], a[4], a[5]);
+        break;
+      case OP_QUADRATIC_CURVE_TO:
+        canvas_quadratic_curve_to(ctx, a[0], a[1], a[2], a[3]);
+        break;
+      case OP_ARC:
+        canvas_arc(ctx, a[0], a[1], a[2], a[3], a[4], a[5]);
+        break;
+      case OP_ARC_TO:
+        canvas_arc_to(ctx, a[0], a[1], a[2], a[3], a[4]);
+        break;
+      case OP_RECT:
+        canvas_rect(ctx, a[0], a[1], a[2], a[3]);
+        break;
+      case OP_CLOSE_PATH:
+        cairo_close_path(ctx);
+        break;
+      case OP_SVG:
+        canvas_svg_path(ctx, op.svg.c_str());
+        break;
+      case OP_POLYLINE:
+        canvas_polyline(ctx, op.xy.data(), op.xy.size() / 2, a[0], false);
+        break;
+      case OP_TRANSFORM:
+        cairo_matrix_init(&matrix, a[0], a[1], a[2], a[3], a[4], a[5]);
+        cairo_save(ctx);
+        cairo_transform(ctx, &matrix);
+        break;
+      case OP_RESTORE:
+        cairo_restore(ctx);
+        break;
+    }
+  }
+}
+
+/*
+ * Append the segments of another path, optionally transformed
+ * by an { a, b, c, d, e, f } matrix.
+ */
+
+NAN_METHOD(Path2D::AddPath) {
+  if (!info[0]->IsObject()
+    || !Path2D::constructor.Get()->HasInstance(info[0]->ToObject()))
+    return Nan::ThrowTypeError("Path2D expected");
+
+  Path2D *path = Nan::ObjectWrap::Unwrap<Path2D>(info.This());
+  Path2D *other = Nan::ObjectWrap::Unwrap<Path2D>(info[0]->ToObject());
+  // copy first, `other` may be `path` itself
+  std::vector<Op> ops(other->_ops);
+
+  if (info[1]->IsObject()) {
+    Local<Object> m = info[1]->ToObject();
+    path->push(OP_TRANSFORM
+      , m->Get(Nan::New("a").ToLocalChecked())->NumberValue()
+      , m->Get(Nan::New("b").ToLocalChecked())->NumberValue()
+      , m->Get(Nan::New("c").ToLocalChecked())->NumberValue()
+      , m->Get(Nan::New("d").ToLocalChecked())->NumberValue()
+      , m->Get(Nan::New("e").ToLocalChecked())->NumberValue()
+      , m->Get(Nan::New("f").ToLocalChecked())->NumberValue());
+    path->_ops.insert(path->_ops.end(), ops.begin(), ops.end());
+    path->push(OP_RESTORE);
+  } else {
+    path->_ops.insert(path->_ops.end(), ops.begin(), ops.end());
+  }
+}
+
+/*
+ * Marks the subpath as closed.
+ */
+
+NAN_METHOD(Path2D::ClosePath) {
+  Path2D *path = Nan::ObjectWrap::Unwrap<Path2D>(info.This());
+  path->push(OP_CLOSE_PATH);
+}
+
+/*
+ * Creates a new subpath at the given point.
+ */
+
+NAN_METHOD(Path2D::MoveTo) {
+  if (!info[0]->IsNumber()
+    ||!info[1]->IsNumber()) return;
+
+  Path2D *path = Nan::ObjectWrap::Unwrap<Path2D>(info.This());
+  path->push(OP_MOVE_TO
+    , info[0]->NumberValue()
+    , info[1]->NumberValue());
+}
+
+/*
+ * Adds a point to the current subpath.
+ */
+
+NAN_METHOD(Path2D::LineTo) {
+  if (!info[0]->IsNumber()
+    ||!info[1]->IsNumber()) return;
+
+  Path2D *path = Nan::ObjectWrap::Unwrap<Path2D>(info.This());
+  path->push(OP_LINE_TO
+    , info[0]->NumberValue()
+    , info[1]->NumberValue());
+}
+
+/*
+ * Bezier curve.
+ */
+
+NAN_METHOD(Path2D::BezierCurveTo) {
+  if (!info[0]->IsNumber()
+    ||!info[1]->IsNumber()
+    ||!info[2]->IsNumber()
+    ||!info[3]->IsNumber()
+    ||!info[4]->IsNumber()
+    ||!info[5]->IsNumber()) return;
+
+  Path2D *path = Nan::ObjectWrap::Unwrap<Path2D>(info.This());
+  path->push(OP_CURVE_TO
+    , info[0]->NumberValue()
+    , info[1]->NumberValue()
+    , info[2]->NumberValue()
+    , info[3]->NumberValue()
+    , info[4]->NumberValue()
+    , info[5]->NumberValue());
+}
+
+/*
+ * Quadratic curve.
+ */
+
+NAN_METHOD(Path2D::QuadraticCurveTo) {
+  if (!info[0]->IsNumber()
+    ||!info[1]->IsNumber()
+    ||!info[2]->IsNumber()
+    ||!info[3]->IsNumber()) return;
+
+  Path2D *path = Nan::ObjectWrap::Unwrap<Path2D>(info.This());
+  path->push(OP_QUADRATIC_CURVE_TO
+    , info[0]->NumberValue()
+    , info[1]->NumberValue()
+    , info[2]->NumberValue()
+    , info[3]->NumberValue());
+}
+
+/*
+ * Adds an arc at x, y with the given radius and start/end angles.
+ */
+
+NAN_METHOD(Path2D::Arc) {
+  if (!info[0]->IsNumber()
+    || !info[1]->IsNumber()
+    || !info[2]->IsNumber()
+    || !info[3]->IsNumber()
+    || !info[4]->IsNumber()) return;
+
+  Path2D *path = Nan::ObjectWrap::Unwrap<Path2D>(info.This());
+  path->push(OP_ARC
+    , info[0]->NumberValue()
+    , info[1]->NumberValue()
+    , info[2]->NumberValue()
+    , info[3]->NumberValue()
+    , info[4]->NumberValue()
+    , info[5]->BooleanValue());
+}
+
+/*
+ * Adds an arcTo point (x0,y0) to (x1,y1) with the given radius.
+ */
+
+NAN_METHOD(Path2D::ArcTo) {
+  if (!info[0]->IsNumber()
+    || !info[1]->IsNumber()
+    || !info[2]->IsNumber()
+    || !info[3]->IsNumber()
+    || !info[4]->IsNumber()) return;
+
+  Path2D *path = Nan::ObjectWrap::Unwrap<Path2D>(info.This());
+  path->push(OP_ARC_TO
+    , info[0]->NumberValue()
+    , info[1]->NumberValue()
+    , info[2]->NumberValue()
+    , info[3]->NumberValue()
+    , info[4]->NumberValue());
+}
+
+/*
+ * Adds a rectangle subpath.
+ */
+
+NAN_METHOD(Path2D::Rect) {
+  if (!info[0]->IsNumber()
+    ||!info[1]->IsNumber()
+    ||!info[2]->IsNumber()
+    ||!info[3]->IsNumber()) return;
+
+  Path2D *path = Nan::ObjectWrap::Unwrap<Path2D>(info.This());
+  path->push(OP_RECT
+    , info[0]->NumberValue()
+    , info[1]->NumberValue()
+    , info[2]->NumberValue()
+    , info[3]->NumberValue());
+}
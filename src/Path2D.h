@@ -0,0 +1,73 @@
+//
+// Path2D.h
+//
+
+#ifndef __NODE_PATH2D_H__
+#define __NODE_PATH2D_H__
+
+#include <string>
+#include <vector>
+#include "Canvas.h"
+
+/*
+ * Path construction helpers shared by Path2D and Context2d.
+ */
+
+void canvas_arc(cairo_t *ctx, double x, double y, double radius, double sa, double ea, bool anticlockwise);
+void canvas_arc_to(cairo_t *ctx, double x1, double y1, double x2, double y2, double radius);
+void canvas_quadratic_curve_to(cairo_t *ctx, double x1, double y1, double x2, double y2);
+void canvas_rect(cairo_t *ctx, double x, double y, double width, double height);
+void canvas_svg_path(cairo_t *ctx, const char *d);
+void canvas_polyline(cairo_t *ctx, const double *xy, size_t n, bool closed, bool simplify);
+
+/*
+ * Reusable path. Segments are kept in user space as doubles and
+ * replayed onto the target context, so they are flattened and
+ * rounded under that context's transform rather than at build time.
+ */
+
+class Path2D: public Nan::ObjectWrap {
+  public:
+    static IsolatePersistent<FunctionTemplate> constructor;
+    static void Initialize(Nan::ADDON_REGISTER_FUNCTION_ARGS_TYPE target);
+    static NAN_METHOD(New);
+    static NAN_METHOD(AddPath);
+    static NAN_METHOD(ClosePath);
+    static NAN_METHOD(MoveTo);
+    static NAN_METHOD(LineTo);
+    static NAN_METHOD(BezierCurveTo);
+    static NAN_METHOD(QuadraticCurveTo);
+    static NAN_METHOD(Arc);
+    static NAN_METHOD(ArcTo);
+    static NAN_METHOD(Rect);
+    void append(cairo_t *ctx);
+
+  private:
+    enum OpType {
+        OP_MOVE_TO
+      , OP_LINE_TO
+      , OP_CURVE_TO
+      , OP_QUADRATIC_CURVE_TO
+      , OP_ARC
+      , OP_ARC_TO
+      , OP_RECT
+      , OP_CLOSE_PATH
+      , OP_SVG
+      , OP_POLYLINE
+      , OP_TRANSFORM
+      , OP_RESTORE
+    };
+
+    struct Op {
+      OpType type;
+      double args[6];
+      std::string svg;
+      std::vector<double> xy;
+    };
+
+    Op &push(OpType type, double a = 0, double b = 0, double c = 0
+      , double d = 0, double e = 0, double f = 0);
+    std::vector<Op> _ops;
+};
+
+#endif
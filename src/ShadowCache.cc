@@ -0,0 +1,158 @@
+//
+// ShadowCache.cc
+//
+
+#include <cmath>
+#include <list>
+#include <map>
+#include "ShadowCache.h"
+
+// Windows doesn't support the C99 names for these
+#ifdef _MSC_VER
+#define isfinite(x) _finite(x)
+#endif
+
+#ifndef isfinite
+#define isfinite(x) std::isfinite(x)
+#endif
+
+/*
+ * Default byte budget for cached masks.
+ */
+
+#define SHADOW_CACHE_DEFAULT_LIMIT (32 << 20)
+
+typedef struct {
+  cairo_surface_t *mask;
+  size_t bytes;
+} shadow_entry_t;
+
+typedef list<pair<shadow_key_t, shadow_entry_t> > shadow_lru_t;
+
+// One cache per thread rendering
+static thread_local shadow_lru_t shadow_lru;
+static thread_local map<shadow_key_t, shadow_lru_t::iterator> shadows;
+static thread_local size_t shadow_bytes = 0;
+static thread_local size_t shadow_limit = SHADOW_CACHE_DEFAULT_LIMIT;
+static thread_local uint32_t shadow_hits = 0;
+static thread_local uint32_t shadow_misses = 0;
+
+/*
+ * Marks image surfaces with cached shadows.
+ */
+
+static cairo_user_data_key_t shadow_source_key;
+
+bool
+shadow_key_append_path(shadow_key_t *key, cairo_path_t *path, double ox, double oy) {
+  if (CAIRO_STATUS_SUCCESS != path->status) return false;
+
+  for (int i = 0; i < path->num_data; i += path->data[i].header.length) {
+    cairo_path_data_t *data = &path->data[i];
+    key->data.push_back(data->header.type);
+    for (int j = 1; j < data->header.length; ++j) {
+      double x = data[j].point.x - ox
+        , y = data[j].point.y - oy;
+      if (!isfinite(x) || !isfinite(y)) return false;
+      key->data.push_back(x);
+      key->data.push_back(y);
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Drop the given entry.
+ */
+
+static void
+shadow_cache_erase(shadow_lru_t::iterator it) {
+  shadows.erase(it->first);
+  cairo_surface_destroy(it->second.mask);
+  shadow_bytes -= it->second.bytes;
+  shadow_lru.erase(it);
+}
+
+/*
+ * Evict least recently used entries until `bytes` fit.
+ */
+
+static void
+shadow_cache_trim(size_t bytes) {
+  while (!shadow_lru.empty() && shadow_bytes + bytes > shadow_limit)
+    shadow_cache_erase(--shadow_lru.end());
+}
+
+/*
+ * Evict the masks of a destroyed image surface.
+ */
+
+static void
+shadow_source_destroyed(void *source) {
+  shadow_lru_t::iterator it = shadow_lru.begin();
+  while (it != shadow_lru.end()) {
+    shadow_lru_t::iterator next = it;
+    ++next;
+    if (it->first.source == source) shadow_cache_erase(it);
+    it = next;
+  }
+}
+
+cairo_surface_t *
+shadow_cache_lookup(const shadow_key_t &key) {
+  map<shadow_key_t, shadow_lru_t::iterator>::iterator it = shadows.find(key);
+  if (it == shadows.end()) {
+    shadow_misses++;
+    return NULL;
+  }
+
+  shadow_hits++;
+  shadow_lru.splice(shadow_lru.begin(), shadow_lru, it->second);
+  return cairo_surface_reference(it->second->second.mask);
+}
+
+void
+shadow_cache_insert(const shadow_key_t &key, cairo_surface_t *mask) {
+  shadow_entry_t entry;
+  entry.bytes = cairo_image_surface_get_stride(mask) * cairo_image_surface_get_height(mask);
+  if (entry.bytes > shadow_limit || shadows.count(key)) return;
+
+  shadow_cache_trim(entry.bytes);
+
+  if (key.source && !cairo_surface_get_user_data(key.source, &shadow_source_key)) {
+    if (cairo_surface_set_user_data(key.source, &shadow_source_key
+      , key.source, shadow_source_destroyed)) return;
+  }
+
+  entry.mask = cairo_surface_reference(mask);
+  shadow_lru.push_front(make_pair(key, entry));
+  shadows[key] = shadow_lru.begin();
+  shadow_bytes += entry.bytes;
+}
+
+void
+shadow_cache_evict(cairo_surface_t *source) {
+  if (!cairo_surface_get_user_data(source, &shadow_source_key)) return;
+  shadow_source_destroyed(source);
+  cairo_surface_set_user_data(source, &shadow_source_key, NULL, NULL);
+}
+
+void
+shadow_cache_stats(uint32_t *hits, uint32_t *misses, uint32_t *size, size_t *bytes) {
+  *hits = shadow_hits;
+  *misses = shadow_misses;
+  *size = (uint32_t) shadow_lru.size();
+  *bytes = shadow_bytes;
+}
+
+size_t
+shadow_cache_limit() {
+  return shadow_limit;
+}
+
+void
+shadow_cache_set_limit(size_t bytes) {
+  shadow_limit = bytes;
+  shadow_cache_trim(0);
+}
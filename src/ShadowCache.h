@@ -0,0 +1,65 @@
+//
+// ShadowCache.h
+//
+
+#ifndef __NODE_SHADOW_CACHE_H__
+#define __NODE_SHADOW_CACHE_H__
+
+#include <vector>
+#include "Canvas.h"
+
+using namespace std;
+
+/*
+ * Cache key. Path shadows leave `source` NULL and describe the path
+ * in device space relative to the mask origin, followed by whatever
+ * else affects the mask. Image shadows set `source` to the image
+ * surface, and are evicted when it is destroyed.
+ */
+
+typedef struct shadow_key {
+  cairo_surface_t *source;
+  vector<double> data;
+
+  bool operator<(const shadow_key &other) const {
+    if (source != other.source) return source < other.source;
+    return data < other.data;
+  }
+} shadow_key_t;
+
+/*
+ * Append the segments of `path`, translated by -ox, -oy, to `key`.
+ * Returns false when the path can't be used as a key.
+ */
+
+bool shadow_key_append_path(shadow_key_t *key, cairo_path_t *path, double ox, double oy);
+
+/*
+ * Return a new reference to the mask cached for `key`, or NULL.
+ */
+
+cairo_surface_t *shadow_cache_lookup(const shadow_key_t &key);
+
+/*
+ * Cache `mask` for `key`, evicting the least recently used
+ * masks to stay within the byte budget.
+ */
+
+void shadow_cache_insert(const shadow_key_t &key, cairo_surface_t *mask);
+
+/*
+ * Evict the masks of `source` now rather than when it's destroyed,
+ * for surfaces that may be destroyed by another thread.
+ */
+
+void shadow_cache_evict(cairo_surface_t *source);
+
+/*
+ * Cache statistics and budget.
+ */
+
+void shadow_cache_stats(uint32_t *hits, uint32_t *misses, uint32_t *size, size_t *bytes);
+size_t shadow_cache_limit();
+void shadow_cache_set_limit(size_t bytes);
+
+#endif /* __NODE_SHADOW_CACHE_H__ */
@@ -0,0 +1,100 @@
+//
+// SurfacePool.cc
+//
+
+#include <string.h>
+#include <list>
+#include "SurfacePool.h"
+
+using namespace std;
+
+/*
+ * Pooled surfaces, most recently released first. Each thread
+ * has a pool of its own.
+ */
+
+static thread_local list<cairo_surface_t *> pool;
+static thread_local size_t pool_bytes = 0;
+static thread_local size_t pool_limit = 0;
+static thread_local uint32_t pool_hits = 0;
+static thread_local uint32_t pool_misses = 0;
+
+static inline size_t
+surface_bytes(cairo_surface_t *surface) {
+  return (size_t) cairo_image_surface_get_stride(surface)
+    * cairo_image_surface_get_height(surface);
+}
+
+/*
+ * Drop the oldest surfaces until `bytes` more fit.
+ */
+
+static void
+surface_pool_trim(size_t bytes) {
+  while (!pool.empty() && pool_bytes + bytes > pool_limit) {
+    cairo_surface_t *surface = pool.back();
+    pool.pop_back();
+    pool_bytes -= surface_bytes(surface);
+    cairo_surface_destroy(surface);
+  }
+}
+
+cairo_surface_t *
+surface_pool_create(cairo_format_t format, int width, int height) {
+  if (pool_limit && width && height) {
+    for (list<cairo_surface_t *>::iterator it = pool.begin(); it != pool.end(); ++it) {
+      cairo_surface_t *surface = *it;
+      if (format != cairo_image_surface_get_format(surface)
+        || width != cairo_image_surface_get_width(surface)
+        || height != cairo_image_surface_get_height(surface)
+        || 1 != cairo_surface_get_reference_count(surface)) continue;
+
+      pool.erase(it);
+      pool_bytes -= surface_bytes(surface);
+      pool_hits++;
+
+      // cleared on reuse rather than on release
+      cairo_surface_flush(surface);
+      memset(cairo_image_surface_get_data(surface), 0, surface_bytes(surface));
+      cairo_surface_mark_dirty(surface);
+      return surface;
+    }
+    pool_misses++;
+  }
+
+  return cairo_image_surface_create(format, width, height);
+}
+
+void
+surface_pool_destroy(cairo_surface_t *surface) {
+  size_t bytes = surface_bytes(surface);
+  if (!bytes
+    || bytes > pool_limit
+    || CAIRO_STATUS_SUCCESS != cairo_surface_status(surface)) {
+    cairo_surface_destroy(surface);
+    return;
+  }
+
+  surface_pool_trim(bytes);
+  pool.push_front(surface);
+  pool_bytes += bytes;
+}
+
+void
+surface_pool_stats(uint32_t *hits, uint32_t *misses, uint32_t *size, size_t *bytes) {
+  *hits = pool_hits;
+  *misses = pool_misses;
+  *size = (uint32_t) pool.size();
+  *bytes = pool_bytes;
+}
+
+size_t
+surface_pool_limit() {
+  return pool_limit;
+}
+
+void
+surface_pool_set_limit(size_t bytes) {
+  pool_limit = bytes;
+  surface_pool_trim(0);
+}
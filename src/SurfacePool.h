@@ -0,0 +1,36 @@
+//
+// SurfacePool.h
+//
+
+#ifndef __NODE_SURFACE_POOL_H__
+#define __NODE_SURFACE_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cairo.h>
+
+/*
+ * Create a cleared image surface, reusing a pooled surface of the
+ * same format and size when there is one.
+ */
+
+cairo_surface_t *surface_pool_create(cairo_format_t format, int width, int height);
+
+/*
+ * Release a reference to an image surface. Surfaces are kept for
+ * reuse while the pool is within its byte limit, and are only handed
+ * out again once the pool holds their last reference.
+ */
+
+void surface_pool_destroy(cairo_surface_t *surface);
+
+/*
+ * Pool statistics and limit. The pool is disabled with a limit of 0,
+ * the default.
+ */
+
+void surface_pool_stats(uint32_t *hits, uint32_t *misses, uint32_t *size, size_t *bytes);
+size_t surface_pool_limit();
+void surface_pool_set_limit(size_t bytes);
+
+#endif /* __NODE_SURFACE_POOL_H__ */
@@ -0,0 +1,152 @@
+//
+// TextLayoutCache.cc
+//
+
+#include <string.h>
+#include <list>
+#include <map>
+#include <string>
+#include "TextLayoutCache.h"
+
+/*
+ * Maximum number of cached layouts.
+ */
+
+#define TEXT_LAYOUT_CACHE_MAX 1024
+
+/*
+ * Simple helper macro for a rather verbose function call.
+ */
+
+#define PANGO_LAYOUT_GET_METRICS(LAYOUT) pango_context_get_metrics( \
+   pango_layout_get_context(LAYOUT), \
+   pango_layout_get_font_description(LAYOUT), \
+   pango_context_get_language(pango_layout_get_context(LAYOUT)))
+
+/*
+ * Cache key. Shaping depends on the text, the font, the merged
+ * font options and the linear part of the ctm; translation only
+ * moves the result so it's left out.
+ */
+
+typedef struct text_layout_key {
+  string text;
+  canvas_font_family_t *family;
+  double size;
+  PangoStyle style;
+  PangoWeight weight;
+  unsigned long options;
+  double xx, yx, xy, yy;
+
+  bool operator<(const text_layout_key &other) const {
+    if (family != other.family) return family < other.family;
+    if (size != other.size) return size < other.size;
+    if (style != other.style) return style < other.style;
+    if (weight != other.weight) return weight < other.weight;
+    if (options != other.options) return options < other.options;
+    if (xx != other.xx) return xx < other.xx;
+    if (yx != other.yx) return yx < other.yx;
+    if (xy != other.xy) return xy < other.xy;
+    if (yy != other.yy) return yy < other.yy;
+    return text < other.text;
+  }
+} text_layout_key_t;
+
+typedef list<pair<text_layout_key_t, text_layout_t> > text_layout_lru_t;
+
+// Layouts belong to the pango font map of the thread that made them
+static thread_local text_layout_lru_t text_layout_lru;
+static thread_local map<text_layout_key_t, text_layout_lru_t::iterator> text_layouts;
+static thread_local uint32_t text_layout_hits = 0;
+static thread_local uint32_t text_layout_misses = 0;
+
+/*
+ * Hash of the font options pango would derive from `cr`.
+ */
+
+static unsigned long
+font_options_hash(cairo_t *cr) {
+  cairo_font_options_t *options = cairo_font_options_create();
+  cairo_font_options_t *cr_options = cairo_font_options_create();
+  cairo_surface_get_font_options(cairo_get_target(cr), options);
+  cairo_get_font_options(cr, cr_options);
+  cairo_font_options_merge(options, cr_options);
+  unsigned long hash = cairo_font_options_hash(options);
+  cairo_font_options_destroy(cr_options);
+  cairo_font_options_destroy(options);
+  return hash;
+}
+
+/*
+ * Drop the least recently used entry.
+ */
+
+static void
+text_layout_evict() {
+  text_layout_lru_t::iterator last = --text_layout_lru.end();
+  text_layouts.erase(last->first);
+  g_object_unref(last->second.layout);
+  font_family_release(last->first.family);
+  text_layout_lru.erase(last);
+}
+
+text_layout_t *
+text_layout_lookup(Context2d *context, const char *str) {
+  cairo_t *cr = context->measureContext();
+  canvas_state_t *state = context->state;
+  cairo_matrix_t matrix;
+  cairo_get_matrix(cr, &matrix);
+
+  text_layout_key_t key;
+  key.text = str;
+  key.family = state->fontFamily;
+  key.size = state->fontSize;
+  key.style = state->fontStyle;
+  key.weight = state->fontWeight;
+  key.options = font_options_hash(cr);
+  key.xx = matrix.xx;
+  key.yx = matrix.yx;
+  key.xy = matrix.xy;
+  key.yy = matrix.yy;
+
+  map<text_layout_key_t, text_layout_lru_t::iterator>::iterator it = text_layouts.find(key);
+  if (it != text_layouts.end()) {
+    text_layout_hits++;
+    text_layout_lru.splice(text_layout_lru.begin(), text_layout_lru, it->second);
+    return &it->second->second;
+  }
+
+  text_layout_misses++;
+
+  text_layout_t entry;
+  entry.layout = pango_cairo_create_layout(cr);
+  pango_layout_set_font_description(entry.layout
+    , pango_layout_get_font_description(context->layout()));
+  pango_layout_set_text(entry.layout, str, -1);
+  pango_layout_get_pixel_extents(entry.layout, &entry.ink_rect, &entry.logical_rect);
+
+  PangoFontMetrics *metrics = PANGO_LAYOUT_GET_METRICS(entry.layout);
+  entry.ascent = pango_font_metrics_get_ascent(metrics);
+  entry.descent = pango_font_metrics_get_descent(metrics);
+  pango_font_metrics_unref(metrics);
+
+  font_family_retain(key.family);
+  text_layout_lru.push_front(make_pair(key, entry));
+  text_layouts[key] = text_layout_lru.begin();
+
+  if (text_layout_lru.size() > TEXT_LAYOUT_CACHE_MAX) text_layout_evict();
+
+  return &text_layout_lru.begin()->second;
+}
+
+void
+text_layout_cache_clear() {
+  while (!text_layout_lru.empty()) text_layout_evict();
+}
+
+void
+text_layout_cache_stats(uint32_t *hits, uint32_t *misses, uint32_t *size) {
+  *hits = text_layout_hits;
+  *misses = text_layout_misses;
+  *size = (uint32_t) text_layout_lru.size();
+}
@@ -0,0 +1,42 @@
+//
+// TextLayoutCache.h
+//
+
+#ifndef __NODE_TEXT_LAYOUT_CACHE_H__
+#define __NODE_TEXT_LAYOUT_CACHE_H__
+
+#include "CanvasRenderingContext2d.h"
+
+/*
+ * Shaped text and its extents. `ascent` and `descent` are
+ * the font metrics in pango units.
+ */
+
+typedef struct {
+  PangoLayout *layout;
+  PangoRectangle ink_rect;
+  PangoRectangle logical_rect;
+  int ascent;
+  int descent;
+} text_layout_t;
+
+/*
+ * Return the cached layout of `str` for the current font of `context`,
+ * shaping it on a miss. The result is only valid until the next lookup.
+ */
+
+text_layout_t *text_layout_lookup(Context2d *context, const char *str);
+
+/*
+ * Free the layouts cached by the calling thread.
+ */
+
+void text_layout_cache_clear();
+
+/*
+ * Cache statistics.
+ */
+
+void text_layout_cache_stats(uint32_t *hits, uint32_t *misses, uint32_t *size);
+
+#endif /* __NODE_TEXT_LAYOUT_CACHE_H__ */
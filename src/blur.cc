@@ -0,0 +1,229 @@
+//
+// blur.cc
+//
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <uv.h>
+#include "blur.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLUR_SSE2 1
+#endif
+
+/*
+ * Three box blur passes approximate a gaussian.
+ */
+
+#define BLUR_PASSES 3
+
+/*
+ * Smaller surfaces are blurred on the calling thread, larger ones
+ * are split across up to BLUR_MAX_THREADS threads with at least
+ * BLUR_MIN_LINES rows or columns each.
+ */
+
+#define BLUR_THREAD_MIN_PIXELS (256 * 256)
+#define BLUR_MAX_THREADS 8
+#define BLUR_MIN_LINES 64
+
+/*
+ * A range of rows, or of columns when `vertical`, to blur.
+ */
+
+typedef struct {
+  uint8_t *data;
+  int width;
+  int height;
+  int stride;
+  int channels;
+  int radius;
+  int start;
+  int end;
+  bool vertical;
+} blur_job_t;
+
+/*
+ * Box blur `n` elements of `channels` bytes spaced `step` bytes apart
+ * in place, with a window of 2 * radius + 1. `line` holds n + 2 * radius
+ * elements and its first and last `radius` elements must be zero.
+ */
+
+static void
+blur_line(uint8_t *p, int n, int step, int channels, int radius, uint8_t *line) {
+  int d = 2 * radius + 1;
+  float inv = 1.f / d;
+
+  if (4 == channels) {
+    uint32_t *src = (uint32_t *) line;
+    for (int i = 0; i < n; ++i) src[radius + i] = *(uint32_t *) (p + i * step);
+
+#ifdef BLUR_SSE2
+    // All four channels in the lanes of one register
+    __m128i zero = _mm_setzero_si128();
+    __m128 scale = _mm_set1_ps(inv);
+    __m128i sum = zero;
+
+#define BLUR_LOAD(px) _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(px), zero), zero)
+
+    for (int i = 0; i < d - 1; ++i) sum = _mm_add_epi32(sum, BLUR_LOAD(src[i]));
+    for (int x = 0; x < n; ++x) {
+      sum = _mm_add_epi32(sum, BLUR_LOAD(src[x + d - 1]));
+      __m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+      v = _mm_packs_epi32(v, v);
+      *(uint32_t *) (p + x * step) = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+      sum = _mm_sub_epi32(sum, BLUR_LOAD(src[x]));
+    }
+
+#undef BLUR_LOAD
+#else
+    uint32_t sum[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < d - 1; ++i)
+      for (int c = 0; c < 4; ++c) sum[c] += line[i * 4 + c];
+    for (int x = 0; x < n; ++x) {
+      uint8_t *out = p + x * step;
+      for (int c = 0; c < 4; ++c) {
+        sum[c] += line[(x + d - 1) * 4 + c];
+        out[c] = sum[c] * inv + 0.5f;
+        sum[c] -= line[x * 4 + c];
+      }
+    }
+#endif
+  } else {
+    for (int i = 0; i < n; ++i) line[radius + i] = p[i * step];
+
+    uint32_t sum = 0;
+    for (int i = 0; i < d - 1; ++i) sum += line[i];
+    for (int x = 0; x < n; ++x) {
+      sum += line[x + d - 1];
+      p[x * step] = sum * inv + 0.5f;
+      sum -= line[x];
+    }
+  }
+}
+
+/*
+ * Blur the rows or columns of a job, all passes at a time.
+ */
+
+static void
+blur_run(void *arg) {
+  blur_job_t *job = (blur_job_t *) arg;
+  int n = job->vertical ? job->height : job->width;
+  int step = job->vertical ? job->stride : job->channels;
+  uint8_t *line = (uint8_t *) calloc(n + 2 * job->radius, job->channels);
+  if (!line) return;
+
+  for (int i = job->start; i < job->end; ++i) {
+    uint8_t *p = job->vertical
+      ? job->data + i * job->channels
+      : job->data + i * job->stride;
+    for (int pass = 0; pass < BLUR_PASSES; ++pass)
+      blur_line(p, n, step, job->channels, job->radius, line);
+  }
+
+  free(line);
+}
+
+int
+canvas_cpus() {
+  static int cpus = 0;
+  if (!cpus) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    cpus = info.dwNumberOfProcessors;
+#else
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (cpus < 1) cpus = 1;
+  }
+  return cpus;
+}
+
+/*
+ * Run `job` over `lines` rows or columns, splitting them
+ * across threads for large surfaces.
+ */
+
+static void
+blur_dispatch(blur_job_t *job, int lines) {
+  int threads = 1;
+  if (job->width * job->height >= BLUR_THREAD_MIN_PIXELS) {
+    threads = canvas_cpus();
+    if (threads > BLUR_MAX_THREADS) threads = BLUR_MAX_THREADS;
+    if (threads > lines / BLUR_MIN_LINES) threads = lines / BLUR_MIN_LINES;
+  }
+
+  if (threads <= 1) {
+    job->start = 0;
+    job->end = lines;
+    blur_run(job);
+    return;
+  }
+
+  blur_job_t jobs[BLUR_MAX_THREADS];
+  uv_thread_t tids[BLUR_MAX_THREADS];
+  bool started[BLUR_MAX_THREADS];
+
+  for (int t = 0; t < threads; ++t) {
+    jobs[t] = *job;
+    jobs[t].start = lines * t / threads;
+    jobs[t].end = lines * (t + 1) / threads;
+  }
+
+  // The calling thread takes the first range
+  for (int t = 1; t < threads; ++t)
+    started[t] = 0 == uv_thread_create(&tids[t], blur_run, &jobs[t]);
+  blur_run(&jobs[0]);
+
+  for (int t = 1; t < threads; ++t) {
+    if (started[t]) uv_thread_join(&tids[t]);
+    else blur_run(&jobs[t]);
+  }
+}
+
+void
+canvas_blur(cairo_surface_t *surface, int radius) {
+  radius = radius * 0.57735f + 0.5f;
+  if (radius < 1) return;
+
+  int channels;
+  switch (cairo_image_surface_get_format(surface)) {
+    case CAIRO_FORMAT_ARGB32:
+    case CAIRO_FORMAT_RGB24:
+      channels = 4;
+      break;
+    case CAIRO_FORMAT_A8:
+      channels = 1;
+      break;
+    default:
+      return;
+  }
+
+  cairo_surface_flush(surface);
+
+  blur_job_t job;
+  job.data = cairo_image_surface_get_data(surface);
+  job.width = cairo_image_surface_get_width(surface);
+  job.height = cairo_image_surface_get_height(surface);
+  job.stride = cairo_image_surface_get_stride(surface);
+  job.channels = channels;
+  job.radius = radius;
+
+  if (job.data && job.width && job.height) {
+    job.vertical = false;
+    blur_dispatch(&job, job.height);
+    job.vertical = true;
+    blur_dispatch(&job, job.width);
+  }
+
+  cairo_surface_mark_dirty(surface);
+}
@@ -0,0 +1,24 @@
+//
+// blur.h
+//
+
+#ifndef __NODE_BLUR_H__
+#define __NODE_BLUR_H__
+
+#include <cairo.h>
+
+/*
+ * Approximate a gaussian blur of the given ARGB32 or A8 image
+ * surface with three separable box blur passes of `radius`.
+ * Pixels outside the surface are treated as transparent.
+ */
+
+void canvas_blur(cairo_surface_t *surface, int radius);
+
+/*
+ * Number of online processors.
+ */
+
+int canvas_cpus();
+
+#endif /* __NODE_BLUR_H__ */
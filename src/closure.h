@@ -29,9 +29,13 @@ typedef struct {
   unsigned max_len;
   uint8_t *data;
   Canvas *canvas;
+  cairo_surface_t *surface;
   cairo_status_t status;
   uint32_t compression_level;
   uint32_t filter;
+  uint32_t quality;
+  uint32_t max_bytes;
+  bool progressive;
 } closure_t;
 
 /*
@@ -42,23 +46,29 @@ cairo_status_t
 closure_init(closure_t *closure, Canvas *canvas, unsigned int compression_level, unsigned int filter) {
   closure->len = 0;
   closure->canvas = canvas;
+  closure->surface = NULL;
   closure->data = (uint8_t *) malloc(closure->max_len = PAGE_SIZE);
   if (!closure->data) return CAIRO_STATUS_NO_MEMORY;
   closure->compression_level = compression_level;
   closure->filter = filter;
+  closure->quality = 75;
+  closure->max_bytes = 0;
+  closure->progressive = false;
   return CAIRO_STATUS_SUCCESS;
 }
 
 /*
- * Free the given closure's data,
- * and hint V8 at the memory dealloc.
+ * Free the given closure's data. Canvases report the
+ * buffers of their PDF and SVG closures to V8 themselves.
  */
 
 void
 closure_destroy(closure_t *closure) {
-  if (closure->len) {
-    free(closure->data);
-    Nan::AdjustExternalMemory(-((intptr_t) closure->max_len));
+  free(closure->data);
+  closure->data = NULL;
+  if (closure->surface) {
+    cairo_surface_destroy(closure->surface);
+    closure->surface = NULL;
   }
 }
 
@@ -0,0 +1,114 @@
+//
+// diff.cc
+//
+
+#include <stdint.h>
+#include <string.h>
+#include "diff.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DIFF_SSE2 1
+#endif
+
+#define DIFF_RED 0xffff0000
+
+/*
+ * Whether pixels `a` and `b` differ by more than `threshold`
+ * in a channel selected by `mask`.
+ */
+
+static inline bool
+pixel_differs(uint32_t a, uint32_t b, uint32_t mask, int threshold) {
+  a &= mask, b &= mask;
+  for (int shift = 0; shift < 32; shift += 8) {
+    int d = (int) ((a >> shift) & 0xff) - (int) ((b >> shift) & 0xff);
+    if (d > threshold || -d > threshold) return true;
+  }
+  return false;
+}
+
+/*
+ * Compare one row, recording differing pixels from column 0.
+ */
+
+static void
+diff_row(const uint32_t *a, const uint32_t *b, uint32_t *out, int width, int y
+  , uint32_t mask, int threshold, canvas_diff_t *result) {
+  int x = 0;
+
+#ifdef DIFF_SSE2
+  // Four pixels at a time, skipping runs within the threshold
+  __m128i zero = _mm_setzero_si128()
+    , limit = _mm_set1_epi8((char) threshold)
+    , keep = _mm_set1_epi32(mask);
+  for (; x + 4 <= width; x += 4) {
+    __m128i va = _mm_loadu_si128((const __m128i *) (a + x))
+      , vb = _mm_loadu_si128((const __m128i *) (b + x))
+      , d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+    d = _mm_and_si128(_mm_subs_epu8(d, limit), keep);
+    int same = _mm_movemask_epi8(_mm_cmpeq_epi32(d, zero));
+    if (0xffff == same) {
+      if (out) _mm_storeu_si128((__m128i *) (out + x), zero);
+      continue;
+    }
+
+    for (int i = 0; i < 4; ++i) {
+      bool differs = 0xf != ((same >> (i * 4)) & 0xf);
+      if (out) out[x + i] = differs ? DIFF_RED : 0;
+      if (!differs) continue;
+      if (!result->count++) result->y1 = y;
+      if (x + i < result->x1) result->x1 = x + i;
+      if (x + i >= result->x2) result->x2 = x + i + 1;
+      result->y2 = y + 1;
+    }
+  }
+#endif
+
+  for (; x < width; ++x) {
+    bool differs = pixel_differs(a[x], b[x], mask, threshold);
+    if (out) out[x] = differs ? DIFF_RED : 0;
+    if (!differs) continue;
+    if (!result->count++) result->y1 = y;
+    if (x < result->x1) result->x1 = x;
+    if (x >= result->x2) result->x2 = x + 1;
+    result->y2 = y + 1;
+  }
+}
+
+void
+canvas_diff(cairo_surface_t *a, cairo_surface_t *b, int threshold
+  , cairo_surface_t *out, canvas_diff_t *result) {
+  int width = cairo_image_surface_get_width(a)
+    , height = cairo_image_surface_get_height(a)
+    , strideA = cairo_image_surface_get_stride(a)
+    , strideB = cairo_image_surface_get_stride(b)
+    , strideOut = out ? cairo_image_surface_get_stride(out) : 0;
+  uint32_t mask = CAIRO_FORMAT_RGB24 == cairo_image_surface_get_format(a)
+    ? 0x00ffffff
+    : 0xffffffff;
+
+  result->count = 0;
+  result->x1 = width;
+  result->y1 = result->x2 = result->y2 = 0;
+
+  uint8_t *dataA = cairo_image_surface_get_data(a)
+    , *dataB = cairo_image_surface_get_data(b)
+    , *dataOut = out ? cairo_image_surface_get_data(out) : NULL;
+
+  if (dataA && dataB) {
+    for (int y = 0; y < height; ++y) {
+      diff_row(
+          (const uint32_t *) (dataA + y * strideA)
+        , (const uint32_t *) (dataB + y * strideB)
+        , dataOut ? (uint32_t *) (dataOut + y * strideOut) : NULL
+        , width
+        , y
+        , mask
+        , threshold
+        , result);
+    }
+  }
+
+  if (!result->count) result->x1 = 0;
+}
@@ -0,0 +1,34 @@
+//
+// diff.h
+//
+
+#ifndef __NODE_DIFF_H__
+#define __NODE_DIFF_H__
+
+#include <stddef.h>
+#include <cairo.h>
+
+/*
+ * Pixels that differ, and their bounding box, x2 and y2 exclusive.
+ * The box is empty when no pixels differ.
+ */
+
+typedef struct {
+  size_t count;
+  int x1, y1, x2, y2;
+} canvas_diff_t;
+
+/*
+ * Compare two ARGB32 or RGB24 image surfaces of the same size. A
+ * pixel differs when a channel differs by more than `threshold`; the
+ * unused byte of RGB24 pixels is ignored. When `out` is given, an
+ * ARGB32 surface of the same size, differing pixels are painted
+ * opaque red in it and the others cleared. Only the surface memory is
+ * touched, so that this can run off the main thread: the caller
+ * flushes the surfaces before and marks `out` dirty after.
+ */
+
+void canvas_diff(cairo_surface_t *a, cairo_surface_t *b, int threshold
+  , cairo_surface_t *out, canvas_diff_t *result);
+
+#endif /* __NODE_DIFF_H__ */
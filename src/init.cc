@@ -12,6 +12,13 @@
 #include "CanvasGradient.h"
 #include "CanvasPattern.h"
 #include "CanvasRenderingContext2d.h"
+#include "Path2D.h"
+#include "ShadowCache.h"
+#include "SurfacePool.h"
+
+#if HAVE_PANGO
+#include "TextLayoutCache.h"
+#endif
 
 #ifdef HAVE_FREETYPE
 #include "FontFace.h"
@@ -23,6 +30,24 @@
 #define snprintf _snprintf
 #endif
 
+/*
+ * Free the cached masks, pooled surfaces, text layouts and fonts of
+ * a thread when its environment, such as a worker's, goes away.
+ */
+
+#if NODE_MODULE_VERSION >= 64
+static void
+release_caches(void *) {
+  shadow_cache_set_limit(0);
+  surface_pool_set_limit(0);
+#if HAVE_PANGO
+  text_layout_cache_clear();
+  font_description_cache_clear();
+  font_family_clear();
+#endif
+}
+#endif
+
 NAN_MODULE_INIT(init) {
   Canvas::Initialize(target);
   Image::Initialize(target);
@@ -30,10 +55,15 @@ NAN_MODULE_INIT(init) {
   Context2d::Initialize(target);
   Gradient::Initialize(target);
   Pattern::Initialize(target);
+  Path2D::Initialize(target);
 #ifdef HAVE_FREETYPE
   FontFace::Initialize(target);
 #endif
 
+#if NODE_MODULE_VERSION >= 64
+  node::AddEnvironmentCleanupHook(Isolate::GetCurrent(), release_caches, NULL);
+#endif
+
   target->Set(Nan::New<String>("cairoVersion").ToLocalChecked(), Nan::New<String>(cairo_version_string()).ToLocalChecked());
 #ifdef HAVE_JPEG
 
@@ -79,4 +109,9 @@ NAN_MODULE_INIT(init) {
 #endif
 }
 
+// Loadable by worker threads as well
+#ifdef NAN_MODULE_WORKER_ENABLED
+NAN_MODULE_WORKER_ENABLED(canvas, init)
+#else
 NODE_MODULE(canvas,init);
+#endif
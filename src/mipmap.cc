@@ -0,0 +1,73 @@
+//
+// mipmap.cc
+//
+
+#include <stdint.h>
+#include "mipmap.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIPMAP_SSE2 1
+#endif
+
+/*
+ * Average the 2x2 blocks of rows `a` and `b` into `n` pixels of `dst`.
+ */
+
+static void
+half_row(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n) {
+  int x = 0;
+
+#ifdef MIPMAP_SSE2
+  // Two output pixels from four input pixels of each row
+  __m128i zero = _mm_setzero_si128();
+  __m128i round = _mm_set1_epi16(2);
+  for (; x + 2 <= n; x += 2) {
+    __m128i ra = _mm_loadu_si128((const __m128i *) (a + x * 8));
+    __m128i rb = _mm_loadu_si128((const __m128i *) (b + x * 8));
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(ra, zero), _mm_unpacklo_epi8(rb, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(ra, zero), _mm_unpackhi_epi8(rb, zero));
+    lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+    hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+    __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), round), 2);
+    _mm_storel_epi64((__m128i *) (dst + x * 4), _mm_packus_epi16(sum, sum));
+  }
+#endif
+
+  for (; x < n; ++x) {
+    for (int c = 0; c < 4; ++c) {
+      dst[x * 4 + c] = (a[x * 8 + c] + a[x * 8 + 4 + c]
+        + b[x * 8 + c] + b[x * 8 + 4 + c] + 2) >> 2;
+    }
+  }
+}
+
+cairo_surface_t *
+canvas_half_size(cairo_surface_t *surface) {
+  cairo_format_t format = cairo_image_surface_get_format(surface);
+  if (CAIRO_FORMAT_ARGB32 != format && CAIRO_FORMAT_RGB24 != format) return NULL;
+
+  int width = cairo_image_surface_get_width(surface) / 2
+    , height = cairo_image_surface_get_height(surface) / 2;
+  if (!width || !height) return NULL;
+
+  cairo_surface_t *half = cairo_image_surface_create(format, width, height);
+  if (CAIRO_STATUS_SUCCESS != cairo_surface_status(half)) {
+    cairo_surface_destroy(half);
+    return NULL;
+  }
+
+  cairo_surface_flush(surface);
+  const uint8_t *src = cairo_image_surface_get_data(surface);
+  uint8_t *dst = cairo_image_surface_get_data(half);
+  int src_stride = cairo_image_surface_get_stride(surface)
+    , dst_stride = cairo_image_surface_get_stride(half);
+
+  for (int y = 0; y < height; ++y) {
+    const uint8_t *a = src + y * 2 * src_stride;
+    half_row(dst + y * dst_stride, a, a + src_stride, width);
+  }
+
+  cairo_surface_mark_dirty(half);
+  return half;
+}
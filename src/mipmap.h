@@ -0,0 +1,19 @@
+//
+// mipmap.h
+//
+
+#ifndef __NODE_MIPMAP_H__
+#define __NODE_MIPMAP_H__
+
+#include <cairo.h>
+
+/*
+ * Return a new surface of half the size of the given ARGB32 or RGB24
+ * image surface, each pixel the average of a 2x2 block. A trailing odd
+ * row or column is dropped. Returns NULL when the surface is too small
+ * or of another format.
+ */
+
+cairo_surface_t *canvas_half_size(cairo_surface_t *surface);
+
+#endif /* __NODE_MIPMAP_H__ */
@@ -0,0 +1,193 @@
+//
+// snapshot.cc
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(SYS_memfd_create)
+#define SNAPSHOT_MEMFD 1
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1
+#endif
+#endif
+#endif
+
+struct canvas_snapshot {
+  int fd;
+  uint8_t *data;
+  size_t size;
+  cairo_format_t format;
+  int width;
+  int height;
+  int stride;
+};
+
+/*
+ * Copy the pixels of `surface` into a new surface.
+ */
+
+static cairo_surface_t *
+snapshot_copy(cairo_surface_t *surface) {
+  int height = cairo_image_surface_get_height(surface)
+    , stride = cairo_image_surface_get_stride(surface);
+  cairo_surface_t *copy = cairo_image_surface_create(
+      cairo_image_surface_get_format(surface)
+    , cairo_image_surface_get_width(surface)
+    , height);
+  if (cairo_surface_status(copy)) return copy;
+
+  uint8_t *src = cairo_image_surface_get_data(surface)
+    , *dst = cairo_image_surface_get_data(copy);
+  int dstStride = cairo_image_surface_get_stride(copy);
+  for (int y = 0; y < height; ++y)
+    memcpy(dst + y * dstStride, src + y * stride, dstStride < stride ? dstStride : stride);
+
+  cairo_surface_mark_dirty(copy);
+  return copy;
+}
+
+#ifdef SNAPSHOT_MEMFD
+
+/*
+ * A private mapping of a snapshot.
+ */
+
+typedef struct {
+  void *data;
+  size_t size;
+} snapshot_mapping_t;
+
+static cairo_user_data_key_t snapshot_mapping_key;
+
+static void
+snapshot_unmap(void *arg) {
+  snapshot_mapping_t *mapping = (snapshot_mapping_t *) arg;
+  munmap(mapping->data, mapping->size);
+  free(mapping);
+}
+
+/*
+ * Whether `snapshot` holds the current pixels of `surface`.
+ */
+
+static bool
+snapshot_matches(canvas_snapshot_t *snapshot, cairo_surface_t *surface) {
+  return snapshot->format == cairo_image_surface_get_format(surface)
+    && snapshot->width == cairo_image_surface_get_width(surface)
+    && snapshot->height == cairo_image_surface_get_height(surface)
+    && snapshot->stride == cairo_image_surface_get_stride(surface)
+    && !memcmp(snapshot->data, cairo_image_surface_get_data(surface), snapshot->size);
+}
+
+/*
+ * Freeze the pixels of `surface` into a memfd, or return NULL.
+ */
+
+static canvas_snapshot_t *
+snapshot_create(cairo_surface_t *surface) {
+  canvas_snapshot_t *snapshot = (canvas_snapshot_t *) malloc(sizeof(canvas_snapshot_t));
+  if (!snapshot) return NULL;
+
+  snapshot->format = cairo_image_surface_get_format(surface);
+  snapshot->width = cairo_image_surface_get_width(surface);
+  snapshot->height = cairo_image_surface_get_height(surface);
+  snapshot->stride = cairo_image_surface_get_stride(surface);
+  snapshot->size = (size_t) snapshot->stride * snapshot->height;
+  snapshot->data = NULL;
+  snapshot->fd = syscall(SYS_memfd_create, "canvas-snapshot", MFD_CLOEXEC);
+
+  if (snapshot->fd < 0 || ftruncate(snapshot->fd, snapshot->size)) {
+    canvas_snapshot_destroy(snapshot);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, snapshot->size, PROT_READ | PROT_WRITE, MAP_SHARED, snapshot->fd, 0);
+  if (MAP_FAILED == data) {
+    canvas_snapshot_destroy(snapshot);
+    return NULL;
+  }
+
+  snapshot->data = (uint8_t *) data;
+  memcpy(snapshot->data, cairo_image_surface_get_data(surface), snapshot->size);
+  mprotect(snapshot->data, snapshot->size, PROT_READ);
+  return snapshot;
+}
+
+cairo_surface_t *
+canvas_snapshot_clone(cairo_surface_t *surface, canvas_snapshot_t **snapshot) {
+  cairo_surface_flush(surface);
+  if (!cairo_image_surface_get_width(surface)
+    || !cairo_image_surface_get_height(surface)) return snapshot_copy(surface);
+
+  if (*snapshot && !snapshot_matches(*snapshot, surface)) {
+    canvas_snapshot_destroy(*snapshot);
+    *snapshot = NULL;
+  }
+  if (!*snapshot) *snapshot = snapshot_create(surface);
+  if (!*snapshot) return snapshot_copy(surface);
+
+  canvas_snapshot_t *s = *snapshot;
+  snapshot_mapping_t *mapping = (snapshot_mapping_t *) malloc(sizeof(snapshot_mapping_t));
+  if (!mapping) return snapshot_copy(surface);
+  mapping->size = s->size;
+  mapping->data = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, s->fd, 0);
+  if (MAP_FAILED == mapping->data) {
+    free(mapping);
+    return snapshot_copy(surface);
+  }
+
+  cairo_surface_t *clone = cairo_image_surface_create_for_data(
+      (unsigned char *) mapping->data
+    , s->format
+    , s->width
+    , s->height
+    , s->stride);
+
+  if (cairo_surface_status(clone)
+    || cairo_surface_set_user_data(clone, &snapshot_mapping_key, mapping, snapshot_unmap)) {
+    cairo_surface_destroy(clone);
+    snapshot_unmap(mapping);
+    return snapshot_copy(surface);
+  }
+
+  return clone;
+}
+
+size_t
+canvas_snapshot_size(canvas_snapshot_t *snapshot) {
+  return snapshot ? snapshot->size : 0;
+}
+
+void
+canvas_snapshot_destroy(canvas_snapshot_t *snapshot) {
+  if (!snapshot) return;
+  if (snapshot->data) munmap(snapshot->data, snapshot->size);
+  if (snapshot->fd >= 0) close(snapshot->fd);
+  free(snapshot);
+}
+
+#else
+
+cairo_surface_t *
+canvas_snapshot_clone(cairo_surface_t *surface, canvas_snapshot_t **snapshot) {
+  cairo_surface_flush(surface);
+  return snapshot_copy(surface);
+}
+
+size_t
+canvas_snapshot_size(canvas_snapshot_t *snapshot) {
+  return 0;
+}
+
+void
+canvas_snapshot_destroy(canvas_snapshot_t *snapshot) {
+}
+
+#endif
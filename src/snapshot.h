@@ -0,0 +1,41 @@
+//
+// snapshot.h
+//
+
+#ifndef __NODE_SNAPSHOT_H__
+#define __NODE_SNAPSHOT_H__
+
+#include <stddef.h>
+#include <cairo.h>
+
+/*
+ * Frozen copy of the pixels of an image surface, which clones map
+ * copy-on-write.
+ */
+
+typedef struct canvas_snapshot canvas_snapshot_t;
+
+/*
+ * Return a new image surface with the pixels of `surface`. Where
+ * supported the pixels are frozen into a snapshot, stored in
+ * `*snapshot`, which the new surface maps copy-on-write so that only
+ * the pages written to are copied. The snapshot in `*snapshot` is
+ * reused while it still matches the surface, and replaced otherwise.
+ * Elsewhere the pixels are copied.
+ */
+
+cairo_surface_t *canvas_snapshot_clone(cairo_surface_t *surface, canvas_snapshot_t **snapshot);
+
+/*
+ * Return the bytes held by the given snapshot, 0 when NULL.
+ */
+
+size_t canvas_snapshot_size(canvas_snapshot_t *snapshot);
+
+/*
+ * Free the given snapshot. Surfaces mapping it are unaffected.
+ */
+
+void canvas_snapshot_destroy(canvas_snapshot_t *snapshot);
+
+#endif /* __NODE_SNAPSHOT_H__ */
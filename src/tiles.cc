@@ -0,0 +1,159 @@
+//
+// tiles.cc
+//
+
+#include <stdint.h>
+#include <uv.h>
+#include "blur.h"
+#include "tiles.h"
+
+/*
+ * Targets of at least TILE_THREAD_MIN_PIXELS are split into bands of at
+ * least TILE_MIN_ROWS rows, TILE_BANDS_PER_THREAD per thread so that
+ * uneven bands balance out, across up to TILE_MAX_THREADS threads.
+ */
+
+#define TILE_THREAD_MIN_PIXELS (512 * 512)
+#define TILE_MIN_ROWS 64
+#define TILE_BANDS_PER_THREAD 4
+#define TILE_MAX_THREADS 64
+
+/*
+ * Paint `source` offset by -ox, -oy into `target`.
+ */
+
+static void
+tile_paint(cairo_surface_t *source, cairo_surface_t *target, double ox, double oy) {
+  cairo_t *ctx = cairo_create(target);
+  cairo_set_operator(ctx, CAIRO_OPERATOR_SOURCE);
+  cairo_set_source_surface(ctx, source, -ox, -oy);
+  cairo_paint(ctx);
+  cairo_destroy(ctx);
+}
+
+#if CAIRO_VERSION_MINOR >= 10
+
+/*
+ * A recording of `source` for another thread to replay. Replaying a
+ * recording writes to it, so threads can't share one. The copy records
+ * a snapshot of `source`, and flushing `source` detaches that snapshot
+ * so that the next copy takes one of its own.
+ */
+
+static cairo_surface_t *
+tile_copy(cairo_surface_t *source) {
+  cairo_surface_t *copy = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, NULL);
+  cairo_t *ctx = cairo_create(copy);
+  cairo_set_source_surface(ctx, source, 0, 0);
+  cairo_paint(ctx);
+  cairo_destroy(ctx);
+  cairo_surface_flush(source);
+  return copy;
+}
+
+/*
+ * Every `threads`th band starting at `thread`, replayed
+ * from a `source` used by this thread alone.
+ */
+
+typedef struct {
+  cairo_surface_t *source;
+  cairo_surface_t *target;
+  int ox;
+  int oy;
+  int bands;
+  int thread;
+  int threads;
+} tile_job_t;
+
+static void
+tile_run(void *arg) {
+  tile_job_t *job = (tile_job_t *) arg;
+  cairo_format_t format = cairo_image_surface_get_format(job->target);
+  uint8_t *data = cairo_image_surface_get_data(job->target);
+  int width = cairo_image_surface_get_width(job->target)
+    , height = cairo_image_surface_get_height(job->target)
+    , stride = cairo_image_surface_get_stride(job->target);
+
+  for (int band = job->thread; band < job->bands; band += job->threads) {
+    int y0 = height * band / job->bands
+      , y1 = height * (band + 1) / job->bands;
+
+    // A view of the band's rows, and a source of its own per band
+    cairo_surface_t *view = cairo_image_surface_create_for_data(
+        data + y0 * stride
+      , format
+      , width
+      , y1 - y0
+      , stride);
+    cairo_surface_t *source = cairo_surface_create_for_rectangle(
+        job->source
+      , job->ox
+      , job->oy + y0
+      , width
+      , y1 - y0);
+
+    tile_paint(source, view, 0, 0);
+    cairo_surface_destroy(source);
+    cairo_surface_finish(view);
+    cairo_surface_destroy(view);
+  }
+}
+
+#endif
+
+void
+canvas_replay_tiles(cairo_surface_t *source, cairo_surface_t *target, int ox, int oy, bool parallel) {
+  int width = cairo_image_surface_get_width(target)
+    , height = cairo_image_surface_get_height(target)
+    , threads = 1;
+
+#if CAIRO_VERSION_MINOR >= 10
+  if (parallel
+    && CAIRO_SURFACE_TYPE_RECORDING == cairo_surface_get_type(source)
+    && width * height >= TILE_THREAD_MIN_PIXELS) {
+    threads = canvas_cpus();
+    if (threads > TILE_MAX_THREADS) threads = TILE_MAX_THREADS;
+    if (threads > height / TILE_MIN_ROWS) threads = height / TILE_MIN_ROWS;
+  }
+#endif
+
+  if (threads <= 1) {
+    tile_paint(source, target, ox, oy);
+    return;
+  }
+
+#if CAIRO_VERSION_MINOR >= 10
+  int bands = threads * TILE_BANDS_PER_THREAD;
+  if (bands > height / TILE_MIN_ROWS) bands = height / TILE_MIN_ROWS;
+
+  tile_job_t jobs[TILE_MAX_THREADS];
+  uv_thread_t tids[TILE_MAX_THREADS];
+  bool started[TILE_MAX_THREADS];
+
+  cairo_surface_flush(target);
+  for (int t = 0; t < threads; ++t) {
+    // The calling thread replays `source` itself
+    jobs[t].source = t ? tile_copy(source) : source;
+    jobs[t].target = target;
+    jobs[t].ox = ox;
+    jobs[t].oy = oy;
+    jobs[t].bands = bands;
+    jobs[t].thread = t;
+    jobs[t].threads = threads;
+  }
+
+  // The calling thread takes the first bands
+  for (int t = 1; t < threads; ++t)
+    started[t] = 0 == uv_thread_create(&tids[t], tile_run, &jobs[t]);
+  tile_run(&jobs[0]);
+
+  for (int t = 1; t < threads; ++t) {
+    if (started[t]) uv_thread_join(&tids[t]);
+    else tile_run(&jobs[t]);
+    cairo_surface_destroy(jobs[t].source);
+  }
+
+  cairo_surface_mark_dirty(target);
+#endif
+}
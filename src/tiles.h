@@ -0,0 +1,22 @@
+//
+// tiles.h
+//
+
+#ifndef __NODE_TILES_H__
+#define __NODE_TILES_H__
+
+#include <cairo.h>
+
+/*
+ * Replace the pixels of the image surface `target` with `source`
+ * offset by -ox, -oy. When `parallel` is set and `source` is a
+ * recording, large targets are split into bands rendered in parallel,
+ * each thread replaying a copy of `source` clipped to its bands, so
+ * that recordings rasterize on all cores. Recordings that sample other
+ * surfaces must not be replayed in parallel, as cairo would share those
+ * surfaces between the threads.
+ */
+
+void canvas_replay_tiles(cairo_surface_t *source, cairo_surface_t *target, int ox, int oy, bool parallel);
+
+#endif /* __NODE_TILES_H__ */
@@ -270,6 +270,1013 @@ describe('Canvas', function () {
     assert.equal('15px Arial, sans-serif', ctx.font);
   });
 
+  it('Context2d#save() / restore() beyond 64 levels', function () {
+    var canvas = new Canvas(200, 200)
+      , ctx = canvas.getContext('2d')
+      , depth = 200;
+
+    for (var i = 0; i < depth; ++i) {
+      ctx.fillStyle = 'rgb(' + i + ',0,0)';
+      ctx.save();
+    }
+
+    for (var i = depth - 1; i >= 0; --i) {
+      ctx.restore();
+      assert.equal('#' + (i < 16 ? '0' : '') + i.toString(16) + '0000', ctx.fillStyle);
+    }
+  });
+
+  it('Context2d.fontCacheStats()', function () {
+    var canvas = new Canvas(200, 200)
+      , ctx = canvas.getContext('2d');
+
+    ctx.font = '13px Arial';
+    var before = Canvas.Context2d.fontCacheStats();
+    ctx.save();
+    ctx.restore();
+    ctx.font = '13px Arial';
+    var after = Canvas.Context2d.fontCacheStats();
+    assert.equal(before.skips + 2, after.skips);
+    assert.equal(before.misses, after.misses);
+
+    ctx.font = '14px Arial';
+    ctx.font = '13px Arial';
+    assert.equal(after.hits + 1, Canvas.Context2d.fontCacheStats().hits);
+  });
+
+  it('Context2d#measureText() reuses shaped text', function () {
+    var canvas = new Canvas(200, 200)
+      , ctx = canvas.getContext('2d');
+
+    ctx.font = '12px Arial';
+    var first = ctx.measureText('cached label')
+      , before = Canvas.Context2d.textLayoutCacheStats()
+      , second = ctx.measureText('cached label')
+      , after = Canvas.Context2d.textLayoutCacheStats();
+
+    assert.equal(first.width, second.width);
+    assert.equal(before.hits + 1, after.hits);
+    assert.equal(before.misses, after.misses);
+
+    ctx.scale(2, 2);
+    ctx.measureText('cached label');
+    assert.equal(after.misses + 1, Canvas.Context2d.textLayoutCacheStats().misses);
+  });
+
+  it('Context2d#measureTextBatch()', function () {
+    var canvas = new Canvas(200, 200)
+      , ctx = canvas.getContext('2d')
+      , labels = ['a', 'hello', 'hello world'];
+
+    var widths = ctx.measureTextBatch(labels);
+    assert.ok(widths instanceof Float64Array);
+    assert.equal(3, widths.length);
+    labels.forEach(function (label, i) {
+      assert.equal(ctx.measureText(label).width, widths[i]);
+    });
+  });
+
+  it('Context2d#fillTextBatch()', function () {
+    var batch = new Canvas(200, 100)
+      , single = new Canvas(200, 100)
+      , labels = ['one', 'two', 'three']
+      , xs = new Float64Array([10, 60, 110])
+      , ys = new Float64Array([30, 50, 70]);
+
+    batch.getContext('2d').fillTextBatch(labels, xs, ys);
+    labels.forEach(function (label, i) {
+      single.getContext('2d').fillText(label, xs[i], ys[i]);
+    });
+
+    assert.equal(single.toDataURL(), batch.toDataURL());
+    assert.throws(function () {
+      batch.getContext('2d').fillTextBatch(labels, new Float64Array(1), ys);
+    }, RangeError);
+    assert.throws(function () {
+      batch.getContext('2d').fillTextBatch(labels, [10, 60, 110], ys);
+    }, /Float64Array/);
+    assert.throws(function () {
+      batch.getContext('2d').fillTextBatch(labels, xs, new Float32Array(3));
+    }, /Float64Array/);
+  });
+
+  it('Context2d#drawImage() upscaled stays within its destination', function () {
+    var source = new Canvas(4, 4);
+    source.getContext('2d').fillStyle = '#f00';
+    source.getContext('2d').fillRect(0, 0, 4, 4);
+
+    var canvas = new Canvas(60, 60)
+      , ctx = canvas.getContext('2d');
+    ctx.drawImage(source, 10, 10, 20, 20);
+    ctx.drawImage(source, 1, 1, 2, 2, 35, 35, 20, 20);
+
+    [[9, 20], [30, 20], [20, 9], [20, 30], [34, 45], [55, 45], [45, 34], [45, 55]].forEach(function (p) {
+      assert.equal(0, ctx.getImageData(p[0], p[1], 1, 1).data[3], p.join());
+    });
+    assert.equal(255, ctx.getImageData(20, 20, 1, 1).data[3]);
+    assert.equal(255, ctx.getImageData(45, 45, 1, 1).data[3]);
+  });
+
+  it('Context2d#drawImage() leaves the current path alone', function () {
+    var canvas = new Canvas(100, 100)
+      , ctx = canvas.getContext('2d')
+      , sprite = new Canvas(10, 10);
+
+    sprite.getContext('2d').fillRect(0, 0, 10, 10);
+
+    ctx.beginPath();
+    ctx.moveTo(10, 50);
+    ctx.bezierCurveTo(10, 10, 90, 10, 90, 50);
+    ctx.drawImage(sprite, 0, 0);
+    ctx.drawImage(sprite, 2, 2, 6, 6, 80, 80, 6, 6);
+    ctx.fillText('x', 50, 90);
+    ctx.lineTo(10, 50);
+
+    assert.ok(ctx.isPointInPath(50, 30));
+    assert.ok(!ctx.isPointInPath(50, 5));
+  });
+
+  it('Context2d#imageSmoothingQuality', function () {
+    var stripes = new Canvas(64, 64)
+      , sctx = stripes.getContext('2d');
+    sctx.fillStyle = '#fff';
+    sctx.fillRect(0, 0, 64, 64);
+    sctx.fillStyle = '#000';
+    for (var x = 0; x < 64; x += 2) sctx.fillRect(x, 0, 1, 64);
+
+    var img = new Canvas.Image();
+    img.src = stripes.toBuffer();
+
+    var canvas = new Canvas(8, 8)
+      , ctx = canvas.getContext('2d');
+    assert.equal('low', ctx.imageSmoothingQuality);
+    ctx.imageSmoothingQuality = 'high';
+    assert.equal('high', ctx.imageSmoothingQuality);
+    ctx.imageSmoothingQuality = 'bogus';
+    assert.equal('high', ctx.imageSmoothingQuality);
+
+    ctx.drawImage(img, 0, 0, 8, 8);
+    var data = ctx.getImageData(0, 0, 8, 8).data;
+    for (var i = 0; i < data.length; i += 4) {
+      assert.equal(128, data[i]);
+      assert.equal(255, data[i + 3]);
+    }
+  });
+
+  it('Context2d#drawImage() integer blits match the general path', function () {
+    var sprite = new Canvas(20, 20)
+      , sctx = sprite.getContext('2d');
+
+    sctx.fillStyle = 'rgba(255, 0, 0, 0.5)';
+    sctx.fillRect(0, 0, 20, 10);
+    sctx.fillStyle = '#00f';
+    sctx.fillRect(0, 10, 20, 10);
+
+    function draw(clip) {
+      var canvas = new Canvas(50, 50)
+        , ctx = canvas.getContext('2d');
+      ctx.fillStyle = '#0f0';
+      ctx.fillRect(0, 0, 50, 50);
+      if (clip) {
+        ctx.rect(0, 0, 50, 50);
+        ctx.clip();
+      }
+      ctx.translate(5, 5);
+      ctx.drawImage(sprite, 0, 0);
+      ctx.drawImage(sprite, 5, 5, 20, 20, 30, 30, 20, 20);
+      ctx.drawImage(sprite, -10, -10);
+      return [].slice.call(ctx.getImageData(0, 0, 50, 50).data);
+    }
+
+    assert.deepEqual(draw(true), draw(false));
+  });
+
+  describe('Path2D', function () {
+    var Path2D = Canvas.Path2D;
+
+    it('builds from SVG path data', function () {
+      var canvas = new Canvas(100, 100)
+        , ctx = canvas.getContext('2d')
+        , path = new Path2D('M10,10 h80 v80 H10 z m20 20 l40 0 0 40 -40 0 z');
+
+      assert.ok(ctx.isPointInPath(path, 20, 20));
+      assert.ok(ctx.isPointInPath(path, 50, 50));
+      assert.ok(!ctx.isPointInPath(path, 50, 50, 'evenodd'));
+      assert.ok(!ctx.isPointInPath(path, 95, 95));
+    });
+
+    it('builds from a Float64Array', function () {
+      var canvas = new Canvas(100, 100)
+        , ctx = canvas.getContext('2d')
+        , path = new Path2D(new Float64Array([10, 10, 90, 10, 90, 90, 10, 90]), true);
+
+      assert.ok(ctx.isPointInPath(path, 50, 50));
+      assert.ok(!ctx.isPointInPath(path, 5, 5));
+    });
+
+    it('fills without touching the current path', function () {
+      var canvas = new Canvas(100, 100)
+        , ctx = canvas.getContext('2d')
+        , path = new Path2D();
+
+      path.rect(0, 0, 50, 50);
+      ctx.beginPath();
+      ctx.rect(60, 60, 10, 10);
+      ctx.fillStyle = 'red';
+      ctx.fill(path);
+
+      var data = ctx.getImageData(25, 25, 1, 1).data;
+      assert.equal(255, data[0]);
+      assert.equal(255, data[3]);
+      assert.ok(ctx.isPointInPath(65, 65));
+      assert.ok(!ctx.isPointInPath(25, 25));
+    });
+
+    it('honors the current transform', function () {
+      var canvas = new Canvas(100, 100)
+        , ctx = canvas.getContext('2d')
+        , path = new Path2D('M0 0 L10 0 L10 10 L0 10 Z');
+
+      ctx.translate(50, 50);
+      ctx.fill(path);
+      assert.equal(255, ctx.getImageData(55, 55, 1, 1).data[3]);
+      assert.equal(0, ctx.getImageData(5, 5, 1, 1).data[3]);
+    });
+
+    it('copies and appends paths', function () {
+      var canvas = new Canvas(100, 100)
+        , ctx = canvas.getContext('2d')
+        , a = new Path2D('M0 0 h10 v10 h-10 z')
+        , b = new Path2D(a);
+
+      b.addPath(a, { a: 1, b: 0, c: 0, d: 1, e: 50, f: 50 });
+      assert.ok(ctx.isPointInPath(b, 5, 5));
+      assert.ok(ctx.isPointInPath(b, 55, 55));
+      assert.ok(!ctx.isPointInPath(a, 55, 55));
+    });
+
+    it('keeps precision under large scales', function () {
+      function draw(usePath) {
+        var canvas = new Canvas(100, 100)
+          , ctx = canvas.getContext('2d')
+          , target = usePath ? new Path2D() : ctx;
+
+        ctx.scale(500, 500);
+        if (!usePath) ctx.beginPath();
+        target.moveTo(0.013, 0.011);
+        target.lineTo(0.187, 0.021);
+        target.arc(0.1, 0.1, 0.07, 0, Math.PI * 1.5, false);
+        target.closePath();
+        if (usePath) ctx.fill(target);
+        else ctx.fill();
+        return ctx.getImageData(0, 0, 100, 100).data;
+      }
+
+      assert.deepEqual(draw(true), draw(false));
+    });
+  });
+
+  it('Context2d#polyline()', function () {
+    var canvas = new Canvas(100, 100)
+      , ctx = canvas.getContext('2d');
+
+    ctx.polyline(new Float64Array([10, 10, 90, 10, 90, 90, 10, 90]), true);
+    assert.ok(ctx.isPointInPath(50, 50));
+
+    ctx.beginPath();
+    ctx.polyline(new Float64Array([10, 10, 40, 10, NaN, NaN, 60, 60, 90, 60, 90, 90]), false);
+    ctx.closePath();
+    assert.ok(ctx.isPointInPath(85, 65));
+    assert.ok(!ctx.isPointInPath(50, 30));
+
+    assert.throws(function () { ctx.polyline([1, 2, 3, 4]); }, TypeError);
+  });
+
+  it('Context2d#polyline() simplify', function () {
+    var canvas = new Canvas(100, 100)
+      , ctx = canvas.getContext('2d')
+      , xy = new Float64Array(2002);
+
+    for (var i = 0; i <= 1000; ++i) {
+      xy[i * 2] = i / 10;
+      xy[i * 2 + 1] = 50;
+    }
+    ctx.polyline(xy, false, true);
+    ctx.lineTo(100, 100);
+    ctx.lineTo(0, 100);
+    ctx.closePath();
+    assert.ok(ctx.isPointInPath(50, 75));
+    assert.ok(!ctx.isPointInPath(50, 25));
+  });
+
+  it('Context2d#polygons()', function () {
+    var canvas = new Canvas(100, 100)
+      , ctx = canvas.getContext('2d')
+      , xy = new Float64Array([
+          0, 0, 40, 0, 40, 40, 0, 40,
+          50, 50, 90, 50, 90, 90, 50, 90])
+      , offsets = new Uint32Array([0, 4]);
+
+    ctx.polygons(xy, offsets);
+    assert.ok(ctx.isPointInPath(20, 20));
+    assert.ok(ctx.isPointInPath(70, 70));
+    assert.ok(!ctx.isPointInPath(45, 45));
+
+    assert.throws(function () {
+      ctx.polygons(xy, new Uint32Array([0, 9]));
+    }, RangeError);
+  });
+
+  it('Context2d.shadowCacheStats()', function () {
+    var canvas = new Canvas(200, 100)
+      , ctx = canvas.getContext('2d');
+
+    ctx.shadowColor = '#000';
+    ctx.shadowBlur = 5;
+    ctx.fillRect(10, 10, 30, 30);
+    var before = Canvas.Context2d.shadowCacheStats();
+    ctx.fillRect(110, 50, 30, 30);
+    var after = Canvas.Context2d.shadowCacheStats();
+    assert.equal(before.hits + 1, after.hits);
+    assert.deepEqual(
+      [].slice.call(ctx.getImageData(5, 5, 45, 45).data),
+      [].slice.call(ctx.getImageData(105, 45, 45, 45).data));
+
+    ctx.clearRect(0, 0, 200, 100);
+    ctx.shadowColor = '#f00';
+    ctx.fillRect(10, 10, 30, 30);
+    assert.equal(after.hits + 1, Canvas.Context2d.shadowCacheStats().hits);
+    var data = ctx.getImageData(8, 25, 1, 1).data;
+    assert.ok(data[0] > 250);
+    assert.equal(0, data[1]);
+    assert.ok(data[3] > 0);
+
+    ctx.shadowBlur = 6;
+    ctx.fillRect(10, 10, 30, 30);
+    assert.equal(after.misses + 1, Canvas.Context2d.shadowCacheStats().misses);
+
+    var limit = after.limit;
+    Canvas.Context2d.setShadowCacheLimit(0);
+    assert.equal(0, Canvas.Context2d.shadowCacheStats().size);
+    Canvas.Context2d.setShadowCacheLimit(Infinity);
+    assert.ok(Canvas.Context2d.shadowCacheStats().limit >= Math.pow(2, 32) - 1);
+    assert.throws(function () {
+      Canvas.Context2d.setShadowCacheLimit(NaN);
+    }, TypeError);
+    Canvas.Context2d.setShadowCacheLimit(limit);
+  });
+
+  it('Context2d#shadowBlur pixels', function () {
+    var canvas = new Canvas(200, 100)
+      , ctx = canvas.getContext('2d');
+
+    // A 20x20 square blurred by three box passes of radius 2,
+    // its mask placed at 20 - 8 + 100 + 1 = 113, 20 - 8 + 1 = 13
+    ctx.shadowColor = '#000';
+    ctx.shadowBlur = 4;
+    ctx.shadowOffsetX = 100;
+    ctx.fillRect(20, 20, 20, 20);
+
+    var expected = [
+        0, 0, 2, 8, 20, 41, 71, 108, 147, 184, 214, 235
+      , 247, 253, 255, 255, 255, 255, 255, 255, 255, 255, 253, 247
+      , 235, 214, 184, 147, 108, 71, 41, 20, 8, 2, 0, 0];
+
+    function alpha(data) {
+      var a = [];
+      for (var i = 0; i < data.length; i += 4) {
+        assert.equal(0, data[i] | data[i + 1] | data[i + 2]);
+        a.push(data[i + 3]);
+      }
+      return a;
+    }
+
+    assert.deepEqual(expected, alpha(ctx.getImageData(113, 31, 36, 1).data));
+    assert.deepEqual(expected, alpha(ctx.getImageData(131, 13, 1, 36).data));
+  });
+
+  it('Context2d#execute()', function () {
+    var canvas = new Canvas(20, 20)
+      , ctx = canvas.getContext('2d')
+      , cmds = new Canvas.CommandBuffer(4);
+
+    cmds.setFillColor(0, 0, 255)
+      .beginPath()
+      .rect(0, 0, 10, 10)
+      .fill()
+      .save()
+      .translate(10, 10)
+      .setFillColor(255, 0, 0, 0.5)
+      .fillRect(0, 0, 10, 10)
+      .restore();
+    ctx.execute(cmds);
+
+    var data = ctx.getImageData(5, 5, 1, 1).data;
+    assert.equal(255, data[2]);
+    assert.equal(255, data[3]);
+    data = ctx.getImageData(15, 15, 1, 1).data;
+    assert.equal(255, data[0]);
+    assert.equal(128, data[3]);
+
+    ctx.execute(new Float64Array([3, 5, 0, 0]).buffer);
+    assert.throws(function () {
+      ctx.execute(new Float64Array([6, 1]));
+    }, RangeError);
+    assert.throws(function () {
+      ctx.execute(new Float64Array([99]));
+    }, TypeError);
+  });
+
+  it('Canvas#type recording', function () {
+    var recording = new Canvas(20, 20, 'recording')
+      , rctx = recording.getContext('2d')
+      , canvas = new Canvas(40, 40)
+      , ctx = canvas.getContext('2d');
+
+    assert.equal('recording', recording.type);
+    rctx.fillStyle = '#f00';
+    rctx.fillRect(0, 0, 10, 10);
+    assert.equal(255, rctx.getImageData(5, 5, 1, 1).data[0]);
+    assert.equal(0, rctx.getImageData(15, 15, 1, 1).data[3]);
+
+    ctx.drawImage(recording, 0, 0, 40, 40);
+    var data = ctx.getImageData(10, 10, 1, 1).data;
+    assert.equal(255, data[0]);
+    assert.equal(255, data[3]);
+    assert.equal(0, ctx.getImageData(30, 30, 1, 1).data[3]);
+
+    var png = recording.toBuffer();
+    assert.equal('PNG', png.toString('ascii', 1, 4));
+  });
+
+  it('Canvas tiled', function () {
+    var canvas = new Canvas(600, 600, { tiled: true })
+      , ctx = canvas.getContext('2d')
+      , reference = new Canvas(600, 600)
+      , rctx = reference.getContext('2d');
+
+    assert.equal('image', canvas.type);
+    [ctx, rctx].forEach(function (c) {
+      c.fillStyle = '#f00';
+      c.fillRect(0, 0, 600, 600);
+      c.fillStyle = 'rgba(0, 0, 255, 0.5)';
+      c.beginPath();
+      c.arc(300, 300, 250, 0, Math.PI * 2);
+      c.fill();
+      c.clearRect(10, 10, 20, 580);
+    });
+
+    assert.deepEqual(
+      [].slice.call(ctx.getImageData(0, 0, 600, 600).data),
+      [].slice.call(rctx.getImageData(0, 0, 600, 600).data));
+    assert.equal('PNG', canvas.toBuffer().toString('ascii', 1, 4));
+
+    assert.throws(function () {
+      new Canvas(10, 10, { tiled: true, pixelFormat: 'A8' });
+    }, TypeError);
+  });
+
+  it('Canvas tiled replays many commands in parallel', function () {
+    this.timeout(10000);
+    var canvas = new Canvas(1024, 1024, { tiled: true })
+      , ctx = canvas.getContext('2d')
+      , reference = new Canvas(1024, 1024)
+      , rctx = reference.getContext('2d')
+      , seed = 1;
+
+    function random() {
+      seed = (seed * 16807) % 2147483647;
+      return seed / 2147483647;
+    }
+
+    for (var i = 0; i < 5000; ++i) {
+      var x = random() * 1024
+        , y = random() * 1024
+        , size = random() * 100
+        , color = 'rgba(' + (random() * 256 | 0) + ', '
+          + (random() * 256 | 0) + ', '
+          + (random() * 256 | 0) + ', ' + random().toFixed(2) + ')'
+        , shape = i % 3;
+      [ctx, rctx].forEach(function (c) {
+        c.fillStyle = c.strokeStyle = color;
+        if (0 == shape) {
+          c.fillRect(x, y, size, size);
+        } else {
+          c.beginPath();
+          c.arc(x, y, size / 2, 0, Math.PI * 2);
+          1 == shape ? c.fill() : c.stroke();
+        }
+      });
+    }
+
+    // Each replay goes through cairo's recording state again
+    var expected = rctx.getImageData(0, 0, 1024, 1024).data;
+    for (var run = 0; run < 3; ++run) {
+      var data = ctx.getImageData(0, 0, 1024, 1024).data
+        , mismatch = -1;
+      for (var j = 0; j < data.length && mismatch < 0; ++j) {
+        if (data[j] !== expected[j]) mismatch = j;
+      }
+      assert.equal(-1, mismatch);
+    }
+  });
+
+  it('Canvas tiled keeps drawing on top of earlier reads', function () {
+    var canvas = new Canvas(200, 200, { tiled: true })
+      , ctx = canvas.getContext('2d')
+      , reference = new Canvas(200, 200)
+      , rctx = reference.getContext('2d');
+
+    function check() {
+      assert.deepEqual(
+        [].slice.call(ctx.getImageData(0, 0, 200, 200).data),
+        [].slice.call(rctx.getImageData(0, 0, 200, 200).data));
+    }
+
+    [ctx, rctx].forEach(function (c) {
+      c.fillStyle = '#0f0';
+      c.fillRect(0, 0, 200, 200);
+      c.translate(20, 20);
+      c.beginPath();
+      c.rect(0, 0, 50, 50);
+    });
+    check();
+
+    // Transform, path and clip carry over to the next recording
+    [ctx, rctx].forEach(function (c) {
+      c.fillStyle = 'rgba(0, 0, 255, 0.5)';
+      c.fill();
+      c.clearRect(60, 60, 20, 20);
+      c.beginPath();
+      c.rect(0, 0, 100, 100);
+      c.clip();
+    });
+    check();
+
+    [ctx, rctx].forEach(function (c) {
+      c.globalCompositeOperation = 'destination-out';
+      c.fillRect(40, -20, 200, 200);
+      c.save();
+    });
+    check();
+
+    // Drawn within save(), so the recording goes on
+    [ctx, rctx].forEach(function (c) {
+      c.globalCompositeOperation = 'source-over';
+      c.fillStyle = '#f00';
+      c.fillRect(10, 10, 10, 10);
+      c.restore();
+    });
+    check();
+    assert.equal('PNG', canvas.toBuffer().toString('ascii', 1, 4));
+  });
+
+  it('Canvas#pixelFormat', function () {
+    assert.equal('ARGB32', new Canvas(10, 10).pixelFormat);
+
+    var mask = new Canvas(10, 10, { pixelFormat: 'A8' })
+      , ctx = mask.getContext('2d');
+    assert.equal('A8', mask.pixelFormat);
+    assert.equal('image', mask.type);
+    ctx.fillStyle = 'rgba(255, 0, 0, 0.5)';
+    ctx.fillRect(0, 0, 5, 10);
+    var data = ctx.getImageData(2, 2, 1, 1).data;
+    assert.equal(0, data[0]);
+    assert.ok(Math.abs(data[3] - 128) <= 1);
+    assert.equal(0, ctx.getImageData(7, 7, 1, 1).data[3]);
+
+    var imageData = ctx.createImageData(1, 1);
+    imageData.data[3] = 255;
+    ctx.putImageData(imageData, 7, 7);
+    assert.equal(255, ctx.getImageData(7, 7, 1, 1).data[3]);
+    assert.equal('PNG', mask.toBuffer().toString('ascii', 1, 4));
+
+    var opaque = new Canvas(10, 10, { pixelFormat: 'RGB24' });
+    ctx = opaque.getContext('2d');
+    ctx.fillStyle = '#f00';
+    ctx.fillRect(0, 0, 10, 10);
+    data = ctx.getImageData(5, 5, 1, 1).data;
+    assert.equal(255, data[0]);
+    assert.equal(255, data[3]);
+
+    var rgb565 = new Canvas(10, 10, { pixelFormat: 'RGB16_565' });
+    rgb565.getContext('2d').fillRect(0, 0, 10, 10);
+    assert.equal('PNG', rgb565.toBuffer().toString('ascii', 1, 4));
+
+    assert.throws(function () {
+      new Canvas(10, 10, { pixelFormat: 'CMYK' });
+    }, TypeError);
+    assert.throws(function () {
+      new Canvas(10, 10, { type: 'pdf', pixelFormat: 'A8' });
+    }, TypeError);
+  });
+
+  it('Canvas with external buffer', function () {
+    var buffer = new Uint8Array(12 * 10)
+      , canvas = new Canvas(2, 10, { buffer: buffer, stride: 12 })
+      , ctx = canvas.getContext('2d');
+
+    ctx.fillStyle = '#f00';
+    ctx.fillRect(1, 5, 1, 1);
+    canvas.flush();
+    // premultiplied native-endian ARGB32
+    var px = new Uint32Array(buffer.buffer, 5 * 12 + 4, 1)[0];
+    assert.equal(0xffff0000, px >>> 0);
+    assert.equal(0, buffer[5 * 12 + 8]);
+
+    buffer[0] = 255;
+    buffer[3] = 255;
+    assert.equal(255, ctx.getImageData(0, 0, 1, 1).data[2]);
+
+    canvas.width = 1;
+    assert.equal(0, buffer[5 * 12 + 4 + 3]);
+    assert.throws(function () {
+      canvas.width = 4;
+    }, RangeError);
+    assert.equal(1, canvas.width);
+
+    if (typeof SharedArrayBuffer !== 'undefined') {
+      var shared = new SharedArrayBuffer(4 * 4);
+      new Canvas(2, 2, { buffer: shared }).getContext('2d').fillRect(0, 0, 2, 2);
+      assert.equal(255, new Uint8Array(shared)[15]);
+    }
+
+    assert.throws(function () {
+      new Canvas(10, 10, { buffer: new ArrayBuffer(10) });
+    }, RangeError);
+    assert.throws(function () {
+      new Canvas(10, 10, { buffer: new ArrayBuffer(400), stride: 20 });
+    }, RangeError);
+  });
+
+  it('Canvas with a detached external buffer', function () {
+    var MessageChannel;
+    try {
+      MessageChannel = require('worker_threads').MessageChannel;
+    } catch (err) {
+      return;
+    }
+
+    var buffer = new ArrayBuffer(4 * 4 * 4)
+      , canvas = new Canvas(4, 4, { buffer: buffer })
+      , ctx = canvas.getContext('2d')
+      , channel = new MessageChannel();
+    channel.port1.postMessage(null, [buffer]);
+    channel.port1.close();
+    assert.equal(0, buffer.byteLength);
+
+    ctx.fillStyle = '#f00';
+    if (process.versions.modules >= 83) {
+      // The canvas holds on to the memory
+      ctx.fillRect(0, 0, 4, 4);
+      assert.equal(255, ctx.getImageData(1, 1, 1, 1).data[0]);
+      canvas.width = 2;
+    } else {
+      assert.throws(function () {
+        ctx.fillRect(0, 0, 4, 4);
+      }, TypeError);
+      assert.throws(function () {
+        canvas.toBuffer();
+      }, TypeError);
+      assert.throws(function () {
+        canvas.width = 2;
+      }, TypeError);
+    }
+  });
+
+  it('Canvas#clone()', function () {
+    var base = new Canvas(100, 100)
+      , ctx = base.getContext('2d');
+    ctx.fillStyle = '#f00';
+    ctx.fillRect(0, 0, 100, 100);
+
+    var a = base.clone()
+      , b = base.clone();
+    assert.equal(100, a.width);
+    assert.equal(100, a.height);
+    assert.equal(255, a.getContext('2d').getImageData(50, 50, 1, 1).data[0]);
+
+    a.getContext('2d').fillStyle = '#00f';
+    a.getContext('2d').fillRect(0, 0, 10, 10);
+    assert.equal(255, a.getContext('2d').getImageData(5, 5, 1, 1).data[2]);
+    assert.equal(255, b.getContext('2d').getImageData(5, 5, 1, 1).data[0]);
+    assert.equal(255, ctx.getImageData(5, 5, 1, 1).data[0]);
+
+    ctx.fillStyle = '#0f0';
+    ctx.fillRect(90, 90, 10, 10);
+    assert.equal(0, b.getContext('2d').getImageData(95, 95, 1, 1).data[1]);
+    assert.equal(255, base.clone().getContext('2d').getImageData(95, 95, 1, 1).data[1]);
+
+    assert.equal('A8', new Canvas(10, 10, { pixelFormat: 'A8' }).clone().pixelFormat);
+    assert.throws(function () {
+      new Canvas(10, 10, 'svg').clone();
+    }, TypeError);
+  });
+
+  it('Canvas#release()', function () {
+    var limit = Canvas.surfacePoolStats().limit;
+    Canvas.setSurfacePoolLimit(1024 * 1024);
+
+    var canvas = new Canvas(50, 50)
+      , ctx = canvas.getContext('2d');
+    ctx.fillStyle = '#f00';
+    ctx.fillRect(0, 0, 50, 50);
+    canvas.release();
+    assert.equal(0, canvas.width);
+    assert.equal(0, canvas.height);
+    assert.equal(1, Canvas.surfacePoolStats().size);
+    assert.equal(50 * 50 * 4, Canvas.surfacePoolStats().bytes);
+
+    var before = Canvas.surfacePoolStats()
+      , reused = new Canvas(50, 50);
+    assert.equal(before.hits + 1, Canvas.surfacePoolStats().hits);
+    assert.equal(0, Canvas.surfacePoolStats().size);
+    assert.equal(0, reused.getContext('2d').getImageData(25, 25, 1, 1).data[3]);
+
+    new Canvas(60, 60);
+    assert.equal(before.misses + 1, Canvas.surfacePoolStats().misses);
+
+    reused.release();
+    Canvas.setSurfacePoolLimit(0);
+    assert.equal(0, Canvas.surfacePoolStats().size);
+    Canvas.setSurfacePoolLimit(1e300);
+    assert.ok(Canvas.surfacePoolStats().limit >= Math.pow(2, 32) - 1);
+    assert.throws(function () {
+      Canvas.setSurfacePoolLimit(NaN);
+    }, TypeError);
+    Canvas.setSurfacePoolLimit(limit);
+  });
+
+  it('Canvas#dispose()', function () {
+    var canvas = new Canvas(50, 50)
+      , ctx = canvas.getContext('2d');
+    ctx.fillRect(0, 0, 50, 50);
+    canvas.dispose();
+    assert.equal(0, canvas.width);
+    assert.equal(0, canvas.height);
+
+    canvas.width = canvas.height = 10;
+    assert.equal(0, ctx.getImageData(5, 5, 1, 1).data[3]);
+    ctx.fillRect(0, 0, 10, 10);
+    assert.equal(255, ctx.getImageData(5, 5, 1, 1).data[3]);
+
+    var pdf = new Canvas(50, 50, 'pdf');
+    pdf.getContext('2d').fillRect(0, 0, 50, 50);
+    pdf.dispose();
+    assert.equal('%PDF', pdf.toBuffer().toString('ascii', 0, 4));
+  });
+
+  it('Canvas#width= clears in place', function () {
+    var canvas = new Canvas(100, 50)
+      , ctx = canvas.getContext('2d');
+    ctx.fillStyle = '#f00';
+    ctx.fillRect(0, 0, 100, 50);
+
+    canvas.width = canvas.width;
+    assert.equal(100, canvas.width);
+    assert.equal(0, ctx.getImageData(50, 25, 1, 1).data[3]);
+
+    ctx.fillRect(0, 0, 100, 50);
+    canvas.width = 30;
+    canvas.height = 20;
+    assert.equal(0, ctx.getImageData(25, 15, 1, 1).data[3]);
+    ctx.fillStyle = '#00f';
+    ctx.fillRect(10, 10, 10, 5);
+    var data = ctx.getImageData(0, 0, 30, 20).data;
+    assert.equal(255, data[(12 * 30 + 15) * 4 + 2]);
+    assert.equal(0, data[(5 * 30 + 15) * 4 + 3]);
+    assert.equal(0, data[(12 * 30 + 25) * 4 + 3]);
+
+    var copy = new Canvas(30, 20);
+    copy.getContext('2d').drawImage(canvas, 0, 0);
+    assert.equal(255, copy.getContext('2d').getImageData(15, 12, 1, 1).data[2]);
+
+    canvas.width = 100;
+    canvas.height = 50;
+    assert.equal(0, ctx.getImageData(15, 12, 1, 1).data[3]);
+    assert.equal(0, ctx.getImageData(90, 40, 1, 1).data[3]);
+  });
+
+  it('Canvas#getContext() allocates on first draw', function () {
+    var limit = Canvas.surfacePoolStats().limit;
+    Canvas.setSurfacePoolLimit(1024 * 1024);
+
+    var before = Canvas.surfacePoolStats()
+      , canvas = new Canvas(100, 50)
+      , ctx = canvas.getContext('2d');
+    ctx.font = '20px sans-serif';
+    assert.ok(ctx.measureText('hello').width > 0);
+    canvas.width = 30;
+    assert.equal(before.misses, Canvas.surfacePoolStats().misses);
+
+    ctx.fillRect(0, 0, 10, 10);
+    assert.equal(before.misses + 1, Canvas.surfacePoolStats().misses);
+    assert.equal(1, ctx.lineWidth);
+    assert.equal(255, ctx.getImageData(5, 5, 1, 1).data[3]);
+
+    canvas.release();
+    Canvas.setSurfacePoolLimit(limit);
+  });
+
+  it('Canvas#width= leaves pixels an async toBuffer() encodes', function (done) {
+    var canvas = new Canvas(200, 200)
+      , ctx = canvas.getContext('2d');
+    ctx.fillStyle = '#f00';
+    ctx.fillRect(0, 0, 200, 200);
+
+    canvas.toBuffer(function (err, buf) {
+      if (err) return done(err);
+      var img = new Canvas.Image();
+      img.src = buf;
+      var check = new Canvas(200, 200)
+        , cctx = check.getContext('2d');
+      cctx.drawImage(img, 0, 0);
+      var data = cctx.getImageData(150, 150, 1, 1).data;
+      assert.equal(255, data[0]);
+      assert.equal(255, data[3]);
+      done();
+    });
+
+    canvas.width = canvas.width;
+    assert.equal(0, ctx.getImageData(150, 150, 1, 1).data[3]);
+    ctx.fillStyle = '#00f';
+    ctx.fillRect(0, 0, 200, 200);
+  });
+
+  it('Canvas.diff()', function (done) {
+    var a = new Canvas(40, 30)
+      , b = new Canvas(40, 30);
+    a.getContext('2d').fillRect(0, 0, 40, 30);
+    b.getContext('2d').fillRect(0, 0, 40, 30);
+
+    var same = Canvas.diff(a, b);
+    assert.equal(0, same.count);
+    assert.strictEqual(null, same.bounds);
+
+    var ctx = b.getContext('2d');
+    ctx.fillStyle = '#f00';
+    ctx.fillRect(5, 7, 3, 2);
+    ctx.fillStyle = 'rgb(1, 0, 0)';
+    ctx.fillRect(30, 20, 2, 2);
+
+    var result = Canvas.diff(a, b, { diff: true });
+    assert.equal(10, result.count);
+    assert.deepEqual({ x: 5, y: 7, width: 27, height: 15 }, result.bounds);
+    var data = result.diff.getContext('2d').getImageData(0, 0, 40, 30).data;
+    assert.equal(255, data[(8 * 40 + 6) * 4]);
+    assert.equal(255, data[(8 * 40 + 6) * 4 + 3]);
+    assert.equal(0, data[(0 * 40 + 0) * 4 + 3]);
+
+    var tolerant = Canvas.diff(a, b, { threshold: 1 });
+    assert.equal(6, tolerant.count);
+    assert.deepEqual({ x: 5, y: 7, width: 3, height: 2 }, tolerant.bounds);
+    assert.strictEqual(undefined, tolerant.diff);
+
+    assert.throws(function () {
+      Canvas.diff(a, new Canvas(10, 10));
+    }, RangeError);
+    assert.throws(function () {
+      Canvas.diff(a, new Canvas(40, 30, 'svg'));
+    }, TypeError);
+
+    Canvas.diff(a, b, { threshold: 1 }, function (err, result) {
+      assert.ifError(err);
+      assert.equal(6, result.count);
+      done();
+    });
+  });
+
+  it('Canvas#getDirtyRegions()', function () {
+    var canvas = new Canvas(600, 300)
+      , ctx = canvas.getContext('2d');
+    assert.deepEqual([{ x: 0, y: 0, width: 600, height: 300 }], canvas.getDirtyRegions());
+
+    canvas.clearDirty();
+    assert.deepEqual([], canvas.getDirtyRegions());
+
+    ctx.fillRect(10, 20, 30, 40);
+    assert.deepEqual([{ x: 10, y: 20, width: 30, height: 40 }], canvas.getDirtyRegions());
+
+    ctx.putImageData(ctx.createImageData(10, 10), 500, 250);
+    ctx.translate(300, 0);
+    ctx.drawImage(new Canvas(20, 20), 0, 0);
+    assert.deepEqual([
+        { x: 10, y: 20, width: 30, height: 40 }
+      , { x: 300, y: 0, width: 20, height: 20 }
+      , { x: 500, y: 250, width: 10, height: 10 }
+    ], canvas.getDirtyRegions().sort(function (a, b) { return a.x - b.x; }));
+
+    assert.deepEqual([
+        { x: 0, y: 0, width: 256, height: 256 }
+      , { x: 256, y: 0, width: 256, height: 256 }
+      , { x: 256, y: 256, width: 256, height: 44 }
+    ], canvas.getDirtyRegions(256).sort(function (a, b) { return a.y - b.y || a.x - b.x; }));
+
+    assert.deepEqual([{ x: 0, y: 0, width: 600, height: 300 }], canvas.getDirtyRegions(Math.pow(2, 40)));
+    assert.throws(function () { canvas.getDirtyRegions(Infinity); }, RangeError);
+    assert.throws(function () { canvas.getDirtyRegions(NaN); }, RangeError);
+
+    canvas.clearDirty();
+    ctx.save();
+    ctx.beginPath();
+    ctx.rect(0, 0, 50, 50);
+    ctx.clip();
+    ctx.fillRect(0, 0, 200, 200);
+    ctx.restore();
+    assert.deepEqual([{ x: 300, y: 0, width: 50, height: 50 }], canvas.getDirtyRegions());
+
+    canvas.clearDirty();
+    ctx.lineWidth = 10;
+    ctx.strokeRect(0, 100, 10, 10);
+    var stroke = canvas.getDirtyRegions()[0];
+    assert.ok(stroke.x <= 295 && stroke.y <= 95);
+    assert.ok(stroke.x + stroke.width >= 315 && stroke.y + stroke.height >= 115);
+
+    canvas.width = 100;
+    assert.deepEqual([{ x: 0, y: 0, width: 100, height: 300 }], canvas.getDirtyRegions());
+  });
+
+  it('Canvas#transfer()', function () {
+    var canvas = new Canvas(20, 10)
+      , ctx = canvas.getContext('2d');
+    ctx.fillStyle = '#f00';
+    ctx.fillRect(0, 0, 20, 10);
+
+    var frame = canvas.transfer();
+    assert.equal(0, canvas.width);
+    assert.equal(0, canvas.height);
+    assert.equal(20, frame.width);
+    assert.equal(10, frame.height);
+    assert.equal('ARGB32', frame.pixelFormat);
+    assert.ok(frame.buffer instanceof ArrayBuffer);
+    assert.equal(frame.stride * 10, frame.buffer.byteLength);
+
+    var received = new Canvas(frame.width, frame.height, frame);
+    assert.equal(255, received.getContext('2d').getImageData(10, 5, 1, 1).data[0]);
+
+    canvas.width = canvas.height = 10;
+    assert.equal(0, ctx.getImageData(5, 5, 1, 1).data[3]);
+
+    assert.throws(function () {
+      received.transfer();
+    }, TypeError);
+    assert.throws(function () {
+      new Canvas(10, 10, 'pdf').transfer();
+    }, TypeError);
+  });
+
+  it('Canvas#transfer() copies pixels still being encoded', function (done) {
+    var canvas = new Canvas(20, 10)
+      , ctx = canvas.getContext('2d');
+    ctx.fillStyle = '#f00';
+    ctx.fillRect(0, 0, 20, 10);
+
+    canvas.toBuffer(function (err, png) {
+      if (err) return done(err);
+      var image = new Canvas.Image;
+      image.src = png;
+      var check = new Canvas(20, 10).getContext('2d');
+      check.drawImage(image, 0, 0);
+      assert.equal(255, check.getImageData(10, 5, 1, 1).data[0]);
+      done();
+    });
+
+    var frame = canvas.transfer();
+    new Uint8Array(frame.buffer).fill(0);
+  });
+
+  it('renders in worker threads', function (done) {
+    var Worker;
+    try {
+      Worker = require('worker_threads').Worker;
+    } catch (err) {
+      return this.skip();
+    }
+
+    var worker = new Worker(
+        "var Canvas = require(" + JSON.stringify(require.resolve('../')) + ")"
+      + "  , parentPort = require('worker_threads').parentPort"
+      + "  , canvas = new Canvas(10, 10)"
+      + "  , ctx = canvas.getContext('2d');"
+      + "ctx.fillStyle = '#00f';"
+      + "ctx.fillRect(0, 0, 10, 10);"
+      + "canvas.toBuffer(function (err, png) {"
+      + "  if (err) throw err;"
+      + "  var frame = canvas.transfer();"
+      + "  parentPort.postMessage({ png: png, frame: frame }, [frame.buffer]);"
+      + "});"
+      , { eval: true });
+
+    worker.on('error', done);
+    worker.on('message', function (msg) {
+      var frame = msg.frame
+        , canvas = new Canvas(frame.width, frame.height, frame);
+      assert.equal('PNG', Buffer.from(msg.png).toString('ascii', 1, 4));
+      assert.equal(255, canvas.getContext('2d').getImageData(5, 5, 1, 1).data[2]);
+      done();
+    });
+  });
+
   it('Context2d#lineWidth=', function () {
     var canvas = new Canvas(200, 200)
       , ctx = canvas.getContext('2d');
@@ -377,6 +1384,59 @@ describe('Canvas', function () {
     });
   });
 
+  describe('#toBuffer("image/jpeg")', function () {
+    var canvas = new Canvas(200, 200)
+      , ctx = canvas.getContext('2d');
+
+    for (var y = 0; y < 200; y += 4) {
+      for (var x = 0; x < 200; x += 4) {
+        ctx.fillStyle = 'rgb(' + (x * 7 % 256) + ',' + (y * 13 % 256) + ',' + ((x + y) * 3 % 256) + ')';
+        ctx.fillRect(x, y, 4, 4);
+      }
+    }
+
+    it('encodes JPEG', function () {
+      var buf = canvas.toBuffer('image/jpeg', { quality: 95 });
+      assert.equal(0xff, buf[0]);
+      assert.equal(0xd8, buf[1]);
+      assert.equal(95, buf.quality);
+    });
+
+    it('lowers quality to fit maxBytes', function () {
+      var full = canvas.toBuffer('image/jpeg', { quality: 95 })
+        , max = Math.floor(full.length / 2)
+        , buf = canvas.toBuffer('image/jpeg', { quality: 95, maxBytes: max });
+      assert.ok(buf.length <= max);
+      assert.ok(buf.quality < 95);
+      assert.equal(0xff, buf[0]);
+      assert.equal(0xd8, buf[1]);
+    });
+
+    it('rejects maxBytes that are not positive', function () {
+      assert.throws(function () {
+        canvas.toBuffer('image/jpeg', { maxBytes: 0 });
+      }, TypeError);
+      assert.throws(function () {
+        canvas.toBuffer('image/jpeg', { maxBytes: -1 });
+      }, TypeError);
+    });
+
+    it('throws when maxBytes cannot be met', function () {
+      assert.throws(function () {
+        canvas.toBuffer('image/jpeg', { maxBytes: 10 });
+      }, /maxBytes/);
+    });
+
+    it('works async', function (done) {
+      canvas.toBuffer('image/jpeg', { quality: 95, maxBytes: 8000 }, function (err, buf, quality) {
+        assert.ok(!err);
+        assert.ok(buf.length <= 8000);
+        assert.equal(quality, buf.quality);
+        done();
+      });
+    });
+  });
+
   describe('#toDataURL()', function () {
     var canvas = new Canvas(200, 200)
       , ctx = canvas.getContext('2d');